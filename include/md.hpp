@@ -36,6 +36,7 @@
 #include "md/forcefield/bruteforce_pairwise_forcefield.hpp"
 #include "md/forcefield/composite_forcefield.hpp"
 #include "md/forcefield/ellipsoid_surface_forcefield.hpp"
+#include "md/forcefield/neighbor_list_registry.hpp"
 #include "md/forcefield/neighbor_pairwise_forcefield.hpp"
 #include "md/forcefield/plane_surface_forcefield.hpp"
 #include "md/forcefield/point_source_forcefield.hpp"
@@ -52,5 +53,6 @@
 #include "md/misc/linear_hash.hpp"
 #include "md/misc/math.hpp"
 #include "md/misc/neighbor_searcher.hpp"
+#include "md/misc/parallel.hpp"
 
 #endif
@@ -11,8 +11,10 @@
 // TODO: Refactor before adding more features.
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
+#include <future>
 #include <iterator>
 #include <memory>
 #include <utility>
@@ -20,6 +22,7 @@
 
 #include "../../basic_types.hpp"
 #include "../../misc/box.hpp"
+#include "../../misc/multilevel_neighbor_searcher.hpp"
 #include "../../misc/neighbor_searcher.hpp"
 #include "neighbor_list_heuristics.hpp"
 
@@ -36,6 +39,9 @@ namespace md
         }
 
         // FIXME: Box abstraction leaks here
+        //
+        // A changed particle count makes rebuild reshape the searcher, whose
+        // grid keeps its capacity within a constant factor of the count.
         inline bool approx(md::open_box box1, md::open_box box2)
         {
             return box1.particle_count == box2.particle_count;
@@ -55,8 +61,76 @@ namespace md
                 && approx(box1.z_span, box2.z_span)
                 && box1.particle_count == box2.particle_count;
         }
+
+        // Compares the periods of the periodic axes and the hints of the open
+        // axes. Both boxes need to be hinted; see same_cell for comparing a
+        // box given by the caller.
+        template<unsigned Mask>
+        bool approx(md::axis_periodic_box<Mask> box1, md::axis_periodic_box<Mask> box2)
+        {
+            using box_type = md::axis_periodic_box<Mask>;
+
+            auto const approx_axis = [](bool periodic, md::scalar period1, md::scalar period2,
+                                        md::scalar span1, md::scalar span2) {
+                return periodic ? approx(period1, period2) : approx(span1, span2);
+            };
+
+            return approx_axis(box_type::x_periodic, box1.x_period, box2.x_period, box1.x_span, box2.x_span)
+                && approx_axis(box_type::y_periodic, box1.y_period, box2.y_period, box1.y_span, box2.y_span)
+                && approx_axis(box_type::z_periodic, box1.z_period, box2.z_period, box1.z_span, box2.z_span)
+                && box1.particle_count == box2.particle_count;
+        }
+
+        // same_cell compares the fields of boxes that define the unit cell,
+        // ignoring the hints (particle_count and spans of open axes) filled
+        // in by set_box_hints. A neighbor list stays valid across changes of
+        // the hints, so a box given by the caller is compared with the hinted
+        // box of the list using this function.
+        inline bool same_cell(md::open_box, md::open_box)
+        {
+            return true;
+        }
+
+        inline bool same_cell(md::periodic_box box1, md::periodic_box box2)
+        {
+            return approx(box1, box2);
+        }
+
+        inline bool same_cell(md::xy_periodic_box box1, md::xy_periodic_box box2)
+        {
+            return approx(box1.x_period, box2.x_period)
+                && approx(box1.y_period, box2.y_period);
+        }
+
+        template<unsigned Mask>
+        bool same_cell(md::axis_periodic_box<Mask> box1, md::axis_periodic_box<Mask> box2)
+        {
+            using box_type = md::axis_periodic_box<Mask>;
+
+            return (!box_type::x_periodic || approx(box1.x_period, box2.x_period))
+                && (!box_type::y_periodic || approx(box1.y_period, box2.y_period))
+                && (!box_type::z_periodic || approx(box1.z_period, box2.z_period));
+        }
     }
 
+    // neighbor_list_layout specifies how neighbor_list stores neighbor pairs.
+    enum class neighbor_list_layout
+    {
+        // Flat array of index pairs (i, j) in the order found by the search.
+        pairs,
+
+        // Compressed sparse rows: the neighbors j > i of each point i are
+        // stored contiguously. Pair loops can then keep the values for i in
+        // registers across all of its neighbors.
+        csr,
+
+        // Compressed sparse rows listing every pair in both directions: the
+        // row of point i has all the neighbors of i. Pair loops evaluate each
+        // pair twice but write only to the values for i, so rows can be
+        // processed in parallel without conflicts.
+        full,
+    };
+
     // neighbor_list is a data structure for efficiently keeping track of
     // neighbor pairs in a slowly moving particle system.
     template<typename Box>
@@ -67,6 +141,7 @@ namespace md
     public:
         neighbor_list()
             : searcher_{prev_box_, prev_verlet_radius_} // FIXME: Poor default
+            , multilevel_searcher_{prev_box_}
         {
         }
 
@@ -76,15 +151,156 @@ namespace md
             targets_.assign(std::begin(targets), std::end(targets));
         }
 
+        // Returns the targets, or an empty array if all points are targets.
+        md::array_view<md::index const> targets() const
+        {
+            return targets_;
+        }
+
+        // Sets the storage layout. The list is rebuilt on the next update.
+        void set_layout(md::neighbor_list_layout layout)
+        {
+            if (layout != layout_) {
+                layout_ = layout;
+                prev_points_.clear();
+                pairs_.clear();
+                rows_.clear();
+                offsets_.clear();
+                neighbors_.clear();
+            }
+        }
+
+        // Returns the storage layout.
+        md::neighbor_list_layout layout() const
+        {
+            return layout_;
+        }
+
+        // Sets the range of the verlet factor, the ratio of the verlet radius
+        // to the cutoff distance. The factor is tuned within the range if
+        // tuning is enabled. Default range is [1.05, 2].
+        void set_verlet_factor_bounds(md::scalar min_factor, md::scalar max_factor)
+        {
+            tuner_.set_bounds(min_factor, max_factor);
+        }
+
+        // Enables or disables online tuning of the verlet factor, which
+        // minimizes the measured cost per update. Disabled by default, so
+        // that the list is reproducible. The factor stays at 1.5 (clamped to
+        // the bounds) if disabled.
+        void set_verlet_tuning(bool enabled)
+        {
+            tuner_.set_enabled(enabled);
+        }
+
+        // Returns the verlet factor used for the next rebuild.
+        md::scalar verlet_factor() const
+        {
+            return tuner_.verlet_factor();
+        }
+
+        // Returns the records of the recent tuning of the verlet factor.
+        std::vector<md::verlet_tuning_record> const& tuning_history() const
+        {
+            return tuner_.history();
+        }
+
+        // Reports the time spent for a loop over the listed pairs. The time is
+        // used for tuning the verlet factor.
+        void record_pair_loop(md::scalar seconds)
+        {
+            tuner_.add_pair_loop(seconds);
+        }
+
+        // Enables or disables background rebuild. If enabled, the next list
+        // is built by a background thread from a snapshot of the points taken
+        // halfway through the expected lifetime of the current list, with a
+        // skin enlarged to cover the displacements after the snapshot. The
+        // next list replaces the current one when it expires, if the points
+        // are still within the enlarged skin. Only the uniform cutoff mode
+        // uses background rebuild.
+        void set_background_rebuild(bool enabled)
+        {
+            background_rebuild_ = enabled;
+        }
+
+        // Returns the number of times a list built in background has replaced
+        // an expired list.
+        md::index background_switch_count() const
+        {
+            return background_switch_count_;
+        }
+
+        // Returns the number of times the list has been replaced by a new
+        // one, either rebuilt or switched to a list built in background.
+        md::index rebuild_count() const
+        {
+            return rebuild_count_;
+        }
+
+        // Returns true if the next list is being built, or has been built, in
+        // background. A copy of the list starts with no such list.
+        bool background_rebuild_pending() const
+        {
+            return background_.done.valid();
+        }
+
         // Rebuilds the neighbor list if necessary.
         void update(md::array_view<md::point const> points, md::scalar dcut, Box box)
         {
-            if (!check_consistency(points, dcut, box)) {
-                rebuild(points, dcut, box);
+            if (check_consistency(points, dcut, box)) {
+                tuner_.count_update();
+                update_count_++;
+                start_background_rebuild(points, dcut, box);
+                return;
+            }
+            rebuild_count_++;
+
+            // Tune only on lists expired due to particle displacements, not
+            // on those invalidated by a changed cutoff distance or box.
+            bool const expired = !prev_points_.empty() && !radius_mode_
+                && detail::approx(dcut, prev_dcut_) && detail::same_cell(box, prev_box_);
+            if (expired) {
+                tuner_.tune();
+                last_interval_ = update_count_;
+            }
+            update_count_ = 1;
+
+            if (expired && switch_to_background_list(points, dcut, box)) {
+                return;
+            }
+            discard_background_list();
+
+            auto const start = clock::now();
+            rebuild(points, dcut, box, tuner_.verlet_factor() * dcut);
+            tuner_.start(seconds_since(start));
+        }
+
+        // Rebuilds the neighbor list if necessary. Pairs (i, j) closer than
+        // radii[i] + radii[j] are listed.
+        void update(
+            md::array_view<md::point const> points,
+            md::array_view<md::scalar const> radii,
+            Box box
+        )
+        {
+            if (check_consistency(points, radii, box)) {
+                tuner_.count_update();
+                return;
             }
+            rebuild_count_++;
+
+            if (!prev_points_.empty() && radius_mode_ && detail::same_cell(box, prev_box_)) {
+                tuner_.tune();
+            }
+            discard_background_list();
+
+            auto const start = clock::now();
+            rebuild(points, radii, box);
+            tuner_.start(seconds_since(start));
         }
 
-        // Range interface.
+        // Range interface. The range is empty in the csr layout.
         iterator begin() const
         {
             return pairs_.begin();
@@ -95,7 +311,37 @@ namespace md
             return pairs_.end();
         }
 
+        // Returns the points owning the rows in the csr and full layouts.
+        // Only points having neighbors own a row. Rows are in the order of
+        // the search grid, so that consecutive rows have nearby points.
+        md::array_view<md::index const> rows() const
+        {
+            return rows_;
+        }
+
+        // Returns the offsets of the rows in the csr and full layouts. The
+        // neighbors of the point rows()[r] are neighbors()[offsets()[r]] to
+        // neighbors()[offsets()[r+1]-1]. There is one more offset than rows.
+        md::array_view<md::index const> offsets() const
+        {
+            return offsets_;
+        }
+
+        // Returns the concatenated rows of neighbor indices in the csr and
+        // full layouts.
+        md::array_view<md::index const> neighbors() const
+        {
+            return neighbors_;
+        }
+
     private:
+        using clock = std::chrono::steady_clock;
+
+        static md::scalar seconds_since(clock::time_point start)
+        {
+            return std::chrono::duration<md::scalar>(clock::now() - start).count();
+        }
+
         // Checks if the previously created neighbor list is still usable with
         // the given configuration.
         bool check_consistency(
@@ -103,17 +349,62 @@ namespace md
         ) const
         {
             // List has not been constructed yet.
-            if (prev_points_.empty()) {
+            if (prev_points_.empty() || radius_mode_) {
                 return false;
             }
 
-            // Geometry has changed.
-            bool const box_changed = !detail::approx(box, prev_box_);
+            // Geometry has changed. The box hints of prev_box_ need not match.
+            bool const box_changed = !detail::same_cell(box, prev_box_);
             bool const dcut_changed = !detail::approx(dcut, prev_dcut_);
             if (box_changed || dcut_changed) {
                 return false;
             }
 
+            // False negatives (unlisted point pairs that fall actually within
+            // dcut) won't arise if the displacement from previous rebuild is
+            // less than or equal to this threshold.
+            md::scalar const threshold = (prev_verlet_radius_ - dcut) / 2;
+
+            return check_displacements(points, threshold, box);
+        }
+
+        // Checks if the previously created neighbor list is still usable with
+        // the given per-point radii.
+        bool check_consistency(
+            md::array_view<md::point const> points,
+            md::array_view<md::scalar const> radii,
+            Box box
+        ) const
+        {
+            if (prev_points_.empty() || !radius_mode_) {
+                return false;
+            }
+
+            if (!detail::same_cell(box, prev_box_)) {
+                return false;
+            }
+
+            if (!check_displacements(points, prev_skin_ / 2, box)) {
+                return false;
+            }
+
+            // Radii have changed. Points are known to be in range here.
+            for (md::index i = 0; i < prev_radii_.size(); i++) {
+                auto const radius = radii[targets_.empty() ? i : targets_[i]];
+                if (radius != prev_radii_[i]) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // Checks if the number of points is unchanged and no point has moved
+        // farther than threshold since the last rebuild.
+        bool check_displacements(
+            md::array_view<md::point const> points, md::scalar threshold, Box box
+        ) const
+        {
             // Number of points changed.
             if (targets_.empty()) { // FIXME: ad-hoc if
                 if (points.size() != prev_points_.size()) {
@@ -126,30 +417,30 @@ namespace md
                 }
             }
 
-            // False negatives (unlisted point pairs that fall actually within
-            // dcut) won't arise if the displacement from previous rebuild is
-            // less than or equal to this threshold.
-            md::scalar const threshold = (prev_verlet_radius_ - dcut) / 2;
-
             if (threshold <= 0) {
                 return false;
             }
 
+            // The plain difference is never shorter than the shortest one, so
+            // wrapping is needed only for points that look far moved, which
+            // are those crossing a periodic boundary.
+            auto const moved_far = [&](md::point point, md::point prev_point) {
+                if ((point - prev_point).squared_norm() <= threshold * threshold) {
+                    return false;
+                }
+                md::vector const disp = box.shortest_displacement(point, prev_point);
+                return disp.squared_norm() > threshold * threshold;
+            };
+
             if (targets_.empty()) { // FIXME: ad-hoc if
                 for (md::index i = 0; i < points.size(); i++) {
-                    md::vector const disp = box.shortest_displacement(
-                        points[i], prev_points_[i]
-                    );
-                    if (disp.squared_norm() > threshold * threshold) {
+                    if (moved_far(points[i], prev_points_[i])) {
                         return false;
                     }
                 }
             } else {
                 for (md::index i = 0; i < prev_points_.size(); i++) {
-                    md::vector const disp = box.shortest_displacement(
-                        points[targets_[i]], prev_points_[i]
-                    );
-                    if (disp.squared_norm() > threshold * threshold) {
+                    if (moved_far(points[targets_[i]], prev_points_[i])) {
                         return false;
                     }
                 }
@@ -158,47 +449,167 @@ namespace md
             return true;
         }
 
-        // Rebuilds the neighbor list.
-        void rebuild(
+        // Starts building the next list in background if the current list is
+        // halfway through the lifetime of the previous one.
+        void start_background_rebuild(
             md::array_view<md::point const> points, md::scalar dcut, Box box
         )
         {
-            if (targets_.empty()) { // FIXME: ad-hoc if
-                prev_points_.assign(points.begin(), points.end());
-            } else {
-                prev_points_.clear();
-                prev_points_.reserve(targets_.size());
-                for (md::index const i : targets_) {
-                    prev_points_.push_back(points[i]);
-                }
+            if (!background_rebuild_ || background_.done.valid()) {
+                return;
+            }
+            if (last_interval_ < 2 || update_count_ < last_interval_ / 2) {
+                return;
             }
 
-            detail::set_box_hints(box, prev_points_);
+            // The next list is used from the expiry of the current list,
+            // around the time points have moved by half the skin since the
+            // snapshot. Enlarging the skin by this amount gives the next list
+            // about the same lifetime as a list built at expiry.
+            md::scalar const verlet_factor = tuner_.verlet_factor();
+            md::scalar const verlet_radius = dcut * (1 + (verlet_factor - 1) * 1.5);
+
+            auto job = std::make_shared<background_job>();
+            job->next.targets_ = targets_;
+            job->next.layout_ = layout_;
+            job->snapshot.assign(points.begin(), points.end());
+
+            background_.job = job;
+            background_.done = std::async(std::launch::async, [=] {
+                auto const start = clock::now();
+                job->next.rebuild(job->snapshot, dcut, box, verlet_radius);
+                job->build_time = seconds_since(start);
+            }).share();
+        }
+
+        // Replaces the expired list with the list built in background if the
+        // latter is valid for the points. Returns true on success.
+        bool switch_to_background_list(
+            md::array_view<md::point const> points, md::scalar dcut, Box box
+        )
+        {
+            if (!background_.done.valid()) {
+                return false;
+            }
+
+            background_.done.get();
+            auto job = background_.job;
+            discard_background_list();
+
+            if (!job->next.check_consistency(points, dcut, box)) {
+                return false;
+            }
+
+            auto& next = job->next;
+            std::swap(prev_box_, next.prev_box_);
+            std::swap(prev_verlet_radius_, next.prev_verlet_radius_);
+            std::swap(prev_dcut_, next.prev_dcut_);
+            std::swap(searcher_, next.searcher_);
+            std::swap(prev_points_, next.prev_points_);
+            std::swap(pairs_, next.pairs_);
+            std::swap(rows_, next.rows_);
+            std::swap(offsets_, next.offsets_);
+            std::swap(neighbors_, next.neighbors_);
+            radius_mode_ = false;
+
+            tuner_.start(job->build_time);
+            background_switch_count_++;
 
-            // Let v be the verlet factor. The cost of list construction scales
-            // with v^3, while the benefit of list reuse scales with (v-1). So
-            // the overall cost scales with v^3/(v-1). The minimum cost is then
-            // achieved when v = 1.5.
-            static constexpr md::scalar verlet_factor = 1.5;
-            md::scalar const verlet_radius = verlet_factor * dcut;
+            return true;
+        }
+
+        // Drops the list being built in background, if any.
+        void discard_background_list()
+        {
+            background_.done = {};
+            background_.job.reset();
+        }
+
+        // Rebuilds the neighbor list with given verlet radius.
+        void rebuild(
+            md::array_view<md::point const> points, md::scalar dcut, Box box, md::scalar verlet_radius
+        )
+        {
+            gather_targets(points, prev_points_);
+            detail::set_box_hints(box, prev_points_);
 
             // Neighbor searcher is expensive to construct. Reuse previous one
-            // if possible.
+            // if possible. A changed box (e.g., the z_span hint of a swelling
+            // film) may be adopted by the existing grid.
             bool const box_changed = !detail::approx(box, prev_box_);
             bool const verlet_changed = !detail::approx(verlet_radius, prev_verlet_radius_);
-            if (box_changed || verlet_changed) {
+            if (verlet_changed || (box_changed && !searcher_.reshape(box))) {
                 searcher_ = md::neighbor_searcher<Box>{box, verlet_radius};
             }
 
             prev_box_ = box;
             prev_verlet_radius_ = verlet_radius;
             prev_dcut_ = dcut;
+            radius_mode_ = false;
+
+            searcher_.update_points(prev_points_);
+            collect_pairs(searcher_, points.size());
+        }
+
+        // Rebuilds the neighbor list with per-point radii.
+        void rebuild(
+            md::array_view<md::point const> points,
+            md::array_view<md::scalar const> radii,
+            Box box
+        )
+        {
+            gather_targets(points, prev_points_);
+            gather_targets(radii, prev_radii_);
+            detail::set_box_hints(box, prev_points_);
+
+            // Same verlet factor as the uniform case applied to the closest
+            // pair of radii, so that a monodisperse system gets the same skin.
+            md::scalar const verlet_factor = tuner_.verlet_factor();
+            md::scalar min_radius = 0;
+            if (!prev_radii_.empty()) {
+                min_radius = *std::min_element(prev_radii_.begin(), prev_radii_.end());
+            }
+            md::scalar const skin = (verlet_factor - 1) * 2 * min_radius;
+
+            bool const box_changed = !detail::approx(box, prev_box_);
+            bool const skin_changed = !detail::approx(skin, prev_skin_);
+            if (!radius_mode_ || box_changed || skin_changed) {
+                multilevel_searcher_ = md::multilevel_neighbor_searcher<Box>{box, skin};
+            }
+
+            prev_box_ = box;
+            prev_skin_ = skin;
+            radius_mode_ = true;
 
+            multilevel_searcher_.set_points(prev_points_, prev_radii_);
+            collect_pairs(multilevel_searcher_, points.size());
+        }
+
+        // Copies the values of the target points, or all values if targets
+        // are not set.
+        template<typename T>
+        void gather_targets(md::array_view<T const> values, std::vector<T>& output) const
+        {
+            if (targets_.empty()) { // FIXME: ad-hoc if
+                output.assign(values.begin(), values.end());
+            } else {
+                output.clear();
+                output.reserve(targets_.size());
+                for (md::index const i : targets_) {
+                    output.push_back(values[i]);
+                }
+            }
+        }
+
+        // Replaces the list with the pairs found by given searcher, mapping
+        // the indices back to the targets.
+        template<typename Searcher>
+        void collect_pairs(Searcher const& searcher, md::index point_count)
+        {
             pairs_.clear();
-            searcher_.set_points(prev_points_);
 
             if (targets_.empty()) { // FIXME: ad-hoc if
-                searcher_.search(std::back_inserter(pairs_));
+                searcher.search(std::back_inserter(pairs_));
             } else {
                 struct index_mapper
                 {
@@ -225,18 +636,129 @@ namespace md
                         return *this;
                     }
                 };
-                searcher_.search(index_mapper { targets_, pairs_ });
+                searcher.search(index_mapper { targets_, pairs_ });
+            }
+
+            if (layout_ != md::neighbor_list_layout::pairs) {
+                compress_pairs(point_count, layout_ == md::neighbor_list_layout::full);
             }
         }
 
+        // Moves the pairs into the csr arrays by counting sort on the first
+        // index, or on both indices if symmetric, leaving pairs_ empty. Rows
+        // are ordered by the first appearance of the point in the search
+        // output, which follows the grid, so that consecutive rows touch
+        // nearby points.
+        void compress_pairs(md::index point_count, bool symmetric)
+        {
+            md::index const no_row = md::index(-1);
+
+            cursors_.assign(point_count, no_row);
+            rows_.clear();
+            offsets_.clear();
+
+            auto const count_neighbor = [&](md::index i) {
+                auto& row = cursors_[i];
+                if (row == no_row) {
+                    row = rows_.size();
+                    rows_.push_back(i);
+                    offsets_.push_back(0);
+                }
+                offsets_[row]++;
+            };
+
+            for (auto const& pair : pairs_) {
+                count_neighbor(pair.first);
+                if (symmetric) {
+                    count_neighbor(pair.second);
+                }
+            }
+            offsets_.push_back(0);
+
+            // Exclusive prefix sum. cursors_ is reused for the write position
+            // of each point.
+            md::index sum = 0;
+            for (auto& offset : offsets_) {
+                auto const count = offset;
+                offset = sum;
+                sum += count;
+            }
+            for (md::index row = 0; row < rows_.size(); row++) {
+                cursors_[rows_[row]] = offsets_[row];
+            }
+
+            neighbors_.resize(offsets_.back());
+            for (auto const& pair : pairs_) {
+                neighbors_[cursors_[pair.first]++] = pair.second;
+                if (symmetric) {
+                    neighbors_[cursors_[pair.second]++] = pair.first;
+                }
+            }
+
+            pairs_.clear();
+        }
+
     private:
+        struct background_job;
+
+        // background_slot holds the list being built in background. A copy
+        // of a slot is empty, so that a copied neighbor_list neither shares
+        // nor waits for the job of the original.
+        struct background_slot
+        {
+            std::shared_ptr<background_job> job;
+            std::shared_future<void> done;
+
+            background_slot() = default;
+            background_slot(background_slot&&) = default;
+            background_slot& operator=(background_slot&&) = default;
+
+            background_slot(background_slot const&)
+            {
+            }
+
+            // Drops the job of this slot.
+            background_slot& operator=(background_slot const&)
+            {
+                done = {};
+                job.reset();
+                return *this;
+            }
+        };
+
         Box prev_box_;
         md::scalar prev_verlet_radius_ = 1;
         md::scalar prev_dcut_ = 1;
         md::neighbor_searcher<Box> searcher_;
+        bool radius_mode_ = false;
+        md::scalar prev_skin_ = 0;
+        md::multilevel_neighbor_searcher<Box> multilevel_searcher_;
+        std::vector<md::scalar> prev_radii_;
         std::vector<md::point> prev_points_;
         std::vector<std::pair<md::index, md::index>> pairs_;
         std::vector<md::index> targets_;
+        detail::verlet_tuner tuner_;
+        md::neighbor_list_layout layout_ = md::neighbor_list_layout::pairs;
+        std::vector<md::index> rows_;
+        std::vector<md::index> offsets_;
+        std::vector<md::index> neighbors_;
+        std::vector<md::index> cursors_;
+        bool background_rebuild_ = false;
+        md::index update_count_ = 0;
+        md::index last_interval_ = 0;
+        md::index background_switch_count_ = 0;
+        md::index rebuild_count_ = 0;
+        background_slot background_;
+    };
+
+    // background_job holds the next list built in background and the snapshot
+    // of the points it is built from.
+    template<typename Box>
+    struct neighbor_list<Box>::background_job
+    {
+        neighbor_list<Box> next;
+        std::vector<md::point> snapshot;
+        md::scalar build_time = 0;
     };
 }
 
@@ -8,7 +8,9 @@
 // This module provides some heuristic helper functions for neighbor_list and
 // subsystem_neighbor_list implementation.
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 #include "../../basic_types.hpp"
 #include "../../misc/box.hpp"
@@ -17,6 +19,18 @@
 
 namespace md
 {
+    // verlet_tuning_record describes a neighbor list that has expired and the
+    // verlet factor (the ratio of the verlet radius to the cutoff distance)
+    // chosen for the next list.
+    struct verlet_tuning_record
+    {
+        md::scalar verlet_factor = 0;
+        md::index update_count = 0;       // Updates served, including the build
+        md::scalar rebuild_time = 0;      // Seconds spent for building the list
+        md::scalar pair_loop_time = 0;    // Seconds spent per update for pair loops
+        md::scalar next_verlet_factor = 0;
+    };
+
     namespace detail
     {
         // determine_hash returns a linear_hash object that is heuristically
@@ -38,14 +52,6 @@ namespace md
             return hash;
         }
 
-        // determine_verlet_radius determines a good vertlet cutoff radius for
-        // neighbor list calculation.
-        inline md::scalar determine_verlet_radius(md::scalar dcut)
-        {
-            // Heuristic: 1.2 gives fairly good performance.
-            return 1.2 * dcut;
-        }
-
         // stddev_points computes the standard deviation of points along each
         // axis.
         inline md::vector stddev_points(md::array_view<md::point const> points)
@@ -111,6 +117,164 @@ namespace md
             auto const unit = (box.x_period + box.y_period) / 20;
             box.z_span = std::ceil(span / unit) * unit;
         }
+
+        template<unsigned Mask>
+        void set_box_hints(
+            md::axis_periodic_box<Mask>& box, md::array_view<md::point const> points
+        )
+        {
+            using box_type = md::axis_periodic_box<Mask>;
+
+            box.particle_count = points.size();
+
+            // Same as xy_periodic_box but for each open axis.
+            constexpr md::scalar span_per_stddev = 3.5;
+            auto const span = span_per_stddev * stddev_points(points);
+
+            // The periods need not be related to the spans (think of a long
+            // fiber), so quantize each span to an eighth of the power of two
+            // below it.
+            auto const quantize = [](md::scalar axis_span) {
+                if (!(axis_span > 0)) {
+                    return axis_span;
+                }
+                auto const unit = std::exp2(std::floor(std::log2(axis_span))) / 8;
+                return std::ceil(axis_span / unit) * unit;
+            };
+            if (!box_type::x_periodic) {
+                box.x_span = quantize(span.x);
+            }
+            if (!box_type::y_periodic) {
+                box.y_span = quantize(span.y);
+            }
+            if (!box_type::z_periodic) {
+                box.z_span = quantize(span.z);
+            }
+        }
+
+        // verlet_tuner adjusts the verlet factor of a neighbor list to the
+        // measured costs of the list.
+        //
+        // Let v be the verlet factor. The cost of list construction R and the
+        // cost of a loop over the listed pairs L scale with v^3, while the
+        // number of updates T a list survives scales with the skin v - 1. The
+        // cost per update, R/T + L, is then minimized at
+        //
+        //     v - 1 = 1 / (1 + sqrt(1 + 3 L / a)),   a = R (v0 - 1) / T,
+        //
+        // where R, L and T are measured on a list built with the factor v0.
+        // This is 1.5 if pair loops are free and approaches 1 as particles
+        // slow down (so that lists survive long).
+        //
+        // Tuning is disabled by default since the measured costs, and hence
+        // the lists, vary from run to run. A disabled tuner keeps the factor.
+        class verlet_tuner
+        {
+        public:
+            // Enables or disables tuning.
+            void set_enabled(bool enabled)
+            {
+                enabled_ = enabled;
+            }
+
+            // Returns true if tuning is enabled.
+            bool enabled() const
+            {
+                return enabled_;
+            }
+
+            // Sets the range of the verlet factor.
+            void set_bounds(md::scalar min_factor, md::scalar max_factor)
+            {
+                min_factor_ = min_factor;
+                max_factor_ = std::max(min_factor, max_factor);
+                factor_ = clamp(factor_);
+            }
+
+            // Returns the verlet factor to use for the next list.
+            md::scalar verlet_factor() const
+            {
+                return factor_;
+            }
+
+            // Returns the records of the recently expired lists, oldest first.
+            std::vector<md::verlet_tuning_record> const& history() const
+            {
+                return history_;
+            }
+
+            // Starts measuring a list that has just been built.
+            void start(md::scalar rebuild_time)
+            {
+                current_ = md::verlet_tuning_record{};
+                current_.verlet_factor = factor_;
+                current_.update_count = 1;
+                current_.rebuild_time = rebuild_time;
+            }
+
+            // Counts an update that reused the list.
+            void count_update()
+            {
+                current_.update_count++;
+            }
+
+            // Adds the time spent for a loop over the listed pairs.
+            void add_pair_loop(md::scalar seconds)
+            {
+                current_.pair_loop_time += seconds;
+            }
+
+            // Chooses the verlet factor for the next list from the costs of
+            // the current list, which expired due to particle displacements.
+            void tune()
+            {
+                if (!enabled_ || current_.update_count == 0) {
+                    return;
+                }
+
+                auto record = current_;
+                record.pair_loop_time /= md::scalar(record.update_count);
+
+                auto const rebuild_cost =
+                    record.rebuild_time * (record.verlet_factor - 1) / md::scalar(record.update_count);
+                // Rebuild every update if rebuilds are free.
+                auto optimum = min_factor_;
+                if (rebuild_cost > 0) {
+                    auto const ratio = record.pair_loop_time / rebuild_cost;
+                    optimum = 1 + 1 / (1 + std::sqrt(1 + 3 * ratio));
+                }
+
+                // Move halfway to damp timing noise, and keep the factor if
+                // the change is too small to be worth a new searcher.
+                auto const next = clamp((factor_ + optimum) / 2);
+                if (std::fabs(next - factor_) > dead_band * factor_) {
+                    factor_ = next;
+                }
+                record.next_verlet_factor = factor_;
+
+                if (history_.size() >= max_history) {
+                    history_.erase(history_.begin());
+                }
+                history_.push_back(record);
+                current_.update_count = 0;
+            }
+
+        private:
+            md::scalar clamp(md::scalar factor) const
+            {
+                return std::min(std::max(factor, min_factor_), max_factor_);
+            }
+
+            static constexpr md::index max_history = 256;
+            static constexpr md::scalar dead_band = 0.02;
+
+            md::scalar min_factor_ = 1.05;
+            md::scalar max_factor_ = 2.0;
+            md::scalar factor_ = 1.5;
+            bool enabled_ = false;
+            md::verlet_tuning_record current_;
+            std::vector<md::verlet_tuning_record> history_;
+        };
     }
 }
 
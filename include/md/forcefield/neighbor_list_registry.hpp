@@ -0,0 +1,156 @@
+// Copyright snsinfu 2019.
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef MD_FORCEFIELD_NEIGHBOR_LIST_REGISTRY_HPP
+#define MD_FORCEFIELD_NEIGHBOR_LIST_REGISTRY_HPP
+
+// This module provides neighbor_list_registry: A pool of neighbor lists shared
+// by the pairwise forcefields of a system.
+
+#include <algorithm>
+#include <deque>
+
+#include "../basic_types.hpp"
+
+#include "detail/neighbor_list.hpp"
+
+
+namespace md
+{
+    // neighbor_list_registry hands out neighbor lists shared by forcefields
+    // with the same box and similar cutoff distances, so that the list is
+    // checked and rebuilt once per step instead of once per forcefield.
+    //
+    // Forcefields whose cutoff distances differ by up to a given ratio share a
+    // list, which is built with the largest cutoff distance among them. Each
+    // forcefield then needs to filter the pairs by its own cutoff distance.
+    // The cutoff range of a list only widens: a list keeps covering the
+    // largest cutoff distance ever requested from it.
+    //
+    // Attach a registry to forcefields with set_neighbor_list_registry. The
+    // forcefields attached to a registry must evaluate the same system in
+    // the same unit cell.
+    //
+    // Nothing calls next_step automatically. Until next_step is called the
+    // lists are checked on every request, as if they were not shared, so
+    // the once-per-step check needs a manual next_step call on every step.
+    // Call it whenever the particles may have moved since the last forcefield
+    // evaluation; a list is not checked again before the next call. With the
+    // simulate_* integrators, call it at the start of the callback, and also
+    // at the end of the callback if the callback evaluates forcefields.
+    template<typename Box>
+    class neighbor_list_registry
+    {
+    public:
+        // Constructor sets the maximum ratio of cutoff distances sharing a
+        // list and the storage layout of the lists.
+        explicit neighbor_list_registry(
+            md::scalar max_cutoff_ratio = 1.5,
+            md::neighbor_list_layout layout = md::neighbor_list_layout::pairs
+        )
+            : max_cutoff_ratio_{max_cutoff_ratio}, layout_{layout}
+        {
+        }
+
+        // Enables or disables background rebuild of the lists. See
+        // neighbor_list::set_background_rebuild.
+        void set_background_rebuild(bool enabled)
+        {
+            background_rebuild_ = enabled;
+            for (auto& shared : lists_) {
+                shared.list.set_background_rebuild(enabled);
+            }
+        }
+
+        // Returns the number of lists created so far.
+        md::index list_count() const
+        {
+            return lists_.size();
+        }
+
+        // Tells that the particles may have moved since the last update. The
+        // lists are checked on the next request for each of them.
+        void next_step()
+        {
+            step_++;
+        }
+
+        // Returns the number of next_step calls so far.
+        md::step step() const
+        {
+            return step_;
+        }
+
+        // Returns the shared neighbor list for the cutoff distance dcut,
+        // updated for the points. The list contains the pairs within the
+        // largest cutoff distance requested for the list.
+        //
+        // The consistency check of the list is skipped if the list has been
+        // checked with the same box and cutoff distance since the last call
+        // of next_step, so the points must not change in between.
+        md::neighbor_list<Box>& update(
+            md::array_view<md::point const> points, md::scalar dcut, Box box
+        )
+        {
+            auto& shared = find_list(dcut);
+
+            bool const checked = step_ != 0
+                && shared.checked_step == step_
+                && shared.checked_dcut == shared.max_dcut
+                && detail::same_cell(box, shared.checked_box);
+
+            if (!checked) {
+                shared.list.update(points, shared.max_dcut, box);
+                shared.checked_step = step_;
+                shared.checked_box = box;
+                shared.checked_dcut = shared.max_dcut;
+            }
+
+            return shared.list;
+        }
+
+    private:
+        struct shared_list
+        {
+            md::scalar min_dcut = 0;
+            md::scalar max_dcut = 0;
+            md::neighbor_list<Box> list;
+            md::step checked_step = 0;
+            Box checked_box;
+            md::scalar checked_dcut = 0;
+        };
+
+        // Returns the list that accepts dcut, widening its cutoff range if
+        // needed, or a new list if no list accepts dcut.
+        shared_list& find_list(md::scalar dcut)
+        {
+            for (auto& shared : lists_) {
+                auto const min_dcut = std::min(shared.min_dcut, dcut);
+                auto const max_dcut = std::max(shared.max_dcut, dcut);
+                if (max_dcut <= max_cutoff_ratio_ * min_dcut) {
+                    shared.min_dcut = min_dcut;
+                    shared.max_dcut = max_dcut;
+                    return shared;
+                }
+            }
+
+            lists_.emplace_back();
+            auto& shared = lists_.back();
+            shared.min_dcut = dcut;
+            shared.max_dcut = dcut;
+            shared.list.set_layout(layout_);
+            shared.list.set_background_rebuild(background_rebuild_);
+            return shared;
+        }
+
+    private:
+        md::scalar max_cutoff_ratio_;
+        md::neighbor_list_layout layout_;
+        bool background_rebuild_ = false;
+        md::step step_ = 0;
+        std::deque<shared_list> lists_;
+    };
+}
+
+#endif
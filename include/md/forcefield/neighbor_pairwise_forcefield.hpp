@@ -8,12 +8,20 @@
 // This module provides a template forcefield implementation that quickly
 // computes short-range pairwise interactions in open and periodic systems.
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
 
 #include "../basic_types.hpp"
 #include "../forcefield.hpp"
 #include "../system.hpp"
 #include "../misc/index_range.hpp"
+#include "../misc/parallel.hpp"
+
+#include "neighbor_list_registry.hpp"
 
 #include "detail/neighbor_list.hpp"
 #include "detail/pair_potfun.hpp"
@@ -31,7 +39,8 @@ namespace md
     //     Returns the unit cell of the system.
     //
     //     md::scalar neighbor_distance(md::system const& system)
-    //     Returns the cutoff distance.
+    //     Returns the cutoff distance. Not used if a neighbor radius attribute
+    //     is set with set_neighbor_radius.
     //
     //     auto neighbor_pairwise_potential(
     //         md::system const& system,
@@ -51,16 +60,68 @@ namespace md
             md::array_view<md::point const> positions = system.view_positions();
             md::scalar sum = 0;
 
-            for (auto const pair : get_neighbor_list(system)) {
+            md::scalar dcut2;
+            auto& list = get_neighbor_list(system, dcut2);
+            auto const start = clock::now();
+
+            for (auto const pair : list) {
                 md::index const i = pair.first;
                 md::index const j = pair.second;
 
-                auto const pot = derived().neighbor_pairwise_potential(system, i, j);
                 auto const r = box.shortest_displacement(positions[i], positions[j]);
+                if (r.squared_norm() > dcut2) {
+                    continue;
+                }
 
+                auto const pot = derived().neighbor_pairwise_potential(system, i, j);
                 sum += pot.evaluate_energy(r);
             }
 
+            // The full layout lists each pair twice. Only the (i < j) half is
+            // summed.
+            auto const rows = list.rows();
+            auto const offsets = list.offsets();
+            auto const neighbors = list.neighbors();
+            bool const full = list.layout() == md::neighbor_list_layout::full;
+            md::index const thread_count = full ? thread_count_ : 1;
+            std::vector<md::scalar> chunk_sums(thread_count);
+
+            md::parallel_for_chunks(
+                thread_count,
+                rows.size(),
+                [&](md::index chunk, md::index begin, md::index end) {
+                    md::scalar chunk_sum = 0;
+
+                    for (md::index row = begin; row < end; row++) {
+                        md::index const i = rows[row];
+                        md::point const position_i = positions[i];
+
+                        for (md::index n = offsets[row]; n < offsets[row + 1]; n++) {
+                            md::index const j = neighbors[n];
+                            if (full && j < i) {
+                                continue;
+                            }
+
+                            auto const r = box.shortest_displacement(position_i, positions[j]);
+                            if (r.squared_norm() > dcut2) {
+                                continue;
+                            }
+
+                            auto const pot = derived().neighbor_pairwise_potential(system, i, j);
+                            chunk_sum += pot.evaluate_energy(r);
+                        }
+                    }
+
+                    chunk_sums[chunk] = chunk_sum;
+                }
+            );
+
+            for (auto const chunk_sum : chunk_sums) {
+                sum += chunk_sum;
+            }
+
+            list.record_pair_loop(seconds_since(start));
+
             return sum;
         }
 
@@ -70,17 +131,60 @@ namespace md
             Box const box = derived().unit_cell(system);
             md::array_view<md::point const> positions = system.view_positions();
 
-            for (auto const pair : get_neighbor_list(system)) {
+            md::scalar dcut2;
+            auto& list = get_neighbor_list(system, dcut2);
+            auto const start = clock::now();
+
+            if (list.layout() == md::neighbor_list_layout::full) {
+                compute_full_rows_force(system, list, dcut2, forces);
+                list.record_pair_loop(seconds_since(start));
+                return;
+            }
+
+            for (auto const pair : list) {
                 md::index const i = pair.first;
                 md::index const j = pair.second;
 
-                auto const pot = derived().neighbor_pairwise_potential(system, i, j);
                 auto const r = box.shortest_displacement(positions[i], positions[j]);
+                if (r.squared_norm() > dcut2) {
+                    continue;
+                }
 
+                auto const pot = derived().neighbor_pairwise_potential(system, i, j);
                 auto const force = pot.evaluate_force(r);
                 forces[i] += force;
                 forces[j] -= force;
             }
+
+            // The csr layout lets the force on i accumulate in registers and
+            // be written once per row.
+            auto const rows = list.rows();
+            auto const offsets = list.offsets();
+            auto const neighbors = list.neighbors();
+
+            for (md::index row = 0; row < rows.size(); row++) {
+                md::index const i = rows[row];
+                md::point const position_i = positions[i];
+                md::vector force_i;
+
+                for (md::index n = offsets[row]; n < offsets[row + 1]; n++) {
+                    md::index const j = neighbors[n];
+
+                    auto const r = box.shortest_displacement(position_i, positions[j]);
+                    if (r.squared_norm() > dcut2) {
+                        continue;
+                    }
+
+                    auto const pot = derived().neighbor_pairwise_potential(system, i, j);
+                    auto const force = pot.evaluate_force(r);
+                    force_i += force;
+                    forces[j] -= force;
+                }
+
+                forces[i] += force_i;
+            }
+
+            list.record_pair_loop(seconds_since(start));
         }
 
         Box unit_cell(md::system const&) const
@@ -97,16 +201,179 @@ namespace md
             return derived();
         }
 
+        // set_neighbor_radius sets the attribute holding per-particle cutoff
+        // radii. Particles i and j are then neighbors if they are closer than
+        // r_i + r_j, which suits mixtures of particles of different sizes.
+        template<typename Tag>
+        Derived& set_neighbor_radius(md::attribute_key<md::scalar, Tag> key)
+        {
+            radius_view_ = [=](md::system const& system) {
+                return system.view(key);
+            };
+            return derived();
+        }
+
+        // set_verlet_factor_bounds sets the range of the ratio of the verlet
+        // radius to the cutoff distance of the neighbor list.
+        Derived& set_verlet_factor_bounds(md::scalar min_factor, md::scalar max_factor)
+        {
+            neighbor_list_.set_verlet_factor_bounds(min_factor, max_factor);
+            return derived();
+        }
+
+        // set_verlet_tuning enables or disables online tuning of the ratio
+        // within the bounds from the measured costs of list rebuilds and pair
+        // loops. Disabled by default because the timings, and hence the
+        // results, vary from run to run.
+        Derived& set_verlet_tuning(bool enabled)
+        {
+            neighbor_list_.set_verlet_tuning(enabled);
+            return derived();
+        }
+
+        // verlet_factor returns the current ratio of the verlet radius to the
+        // cutoff distance.
+        md::scalar verlet_factor() const
+        {
+            return neighbor_list_.verlet_factor();
+        }
+
+        // verlet_tuning_history returns the records of recent tunings of the
+        // verlet factor.
+        std::vector<md::verlet_tuning_record> const& verlet_tuning_history() const
+        {
+            return neighbor_list_.tuning_history();
+        }
+
+        // set_neighbor_list_layout sets the storage layout of the neighbor
+        // list. The csr layout groups the neighbors of each particle, which
+        // speeds up pair loops in large systems. The full layout lists each
+        // pair for both particles so that force loops can run in parallel.
+        Derived& set_neighbor_list_layout(md::neighbor_list_layout layout)
+        {
+            neighbor_list_.set_layout(layout);
+            return derived();
+        }
+
+        // set_background_neighbor_rebuild enables or disables building the
+        // next neighbor list in a background thread while the current list
+        // is in use, which takes most rebuilds off the critical path.
+        Derived& set_background_neighbor_rebuild(bool enabled)
+        {
+            neighbor_list_.set_background_rebuild(enabled);
+            return derived();
+        }
+
+        // set_neighbor_list_registry makes the forcefield use a neighbor list
+        // shared with the other forcefields attached to the registry. Not
+        // used if neighbor targets or a neighbor radius attribute are set.
+        // The shared list is checked once per neighbor_list_registry::
+        // next_step call, which the simulation loop needs to make.
+        //
+        // Pairs on a shared list are filtered by the neighbor distance,
+        // while the own list also passes the pairs within the verlet skin
+        // to the potential. The results agree only if the potential vanishes
+        // beyond the neighbor distance. The layout and background rebuild of
+        // a shared list are set on the registry and its verlet factor is not
+        // tuned. The forcefield setters of these have no effect on it.
+        Derived& set_neighbor_list_registry(std::shared_ptr<md::neighbor_list_registry<Box>> registry)
+        {
+            registry_ = registry;
+            return derived();
+        }
+
+        // set_thread_count sets the number of threads used for the pair loops
+        // in the full neighbor list layout. Other layouts are processed
+        // serially. neighbor_pairwise_potential must be safe to call from
+        // multiple threads.
+        Derived& set_thread_count(md::index thread_count)
+        {
+            thread_count_ = std::max(thread_count, md::index(1));
+            return derived();
+        }
+
     private:
-        // get_neighbor_list returns a reference to the up-to-date neighbor list
-        // for the system.
-        md::neighbor_list<Box> const& get_neighbor_list(md::system const& system)
+        using clock = std::chrono::steady_clock;
+
+        static md::scalar seconds_since(clock::time_point start)
         {
-            neighbor_list_.update(
-                system.view_positions(),
-                derived().neighbor_distance(system),
-                derived().unit_cell(system)
+            return std::chrono::duration<md::scalar>(clock::now() - start).count();
+        }
+
+        // compute_full_rows_force computes forces using the full neighbor
+        // list. Each thread owns a contiguous range of rows and writes only
+        // the forces on the owners of the rows. Each pair is evaluated twice,
+        // which costs less than reducing per-thread force buffers on many
+        // cores.
+        void compute_full_rows_force(
+            md::system const& system,
+            md::neighbor_list<Box> const& list,
+            md::scalar dcut2,
+            md::array_view<md::vector> forces
+        )
+        {
+            Box const box = derived().unit_cell(system);
+            md::array_view<md::point const> positions = system.view_positions();
+
+            auto const rows = list.rows();
+            auto const offsets = list.offsets();
+            auto const neighbors = list.neighbors();
+
+            md::parallel_for_chunks(
+                thread_count_,
+                rows.size(),
+                [&](md::index, md::index begin, md::index end) {
+                    for (md::index row = begin; row < end; row++) {
+                        md::index const i = rows[row];
+                        md::point const position_i = positions[i];
+                        md::vector force_i;
+
+                        for (md::index n = offsets[row]; n < offsets[row + 1]; n++) {
+                            md::index const j = neighbors[n];
+
+                            auto const r = box.shortest_displacement(position_i, positions[j]);
+                            if (r.squared_norm() > dcut2) {
+                                continue;
+                            }
+
+                            auto const pot = derived().neighbor_pairwise_potential(system, i, j);
+                            force_i += pot.evaluate_force(r);
+                        }
+
+                        forces[i] += force_i;
+                    }
+                }
             );
+        }
+
+        // get_neighbor_list returns a reference to the up-to-date neighbor list
+        // for the system. Pairs farther than sqrt(dcut2) need to be skipped.
+        // The cutoff is infinite for the own list, which lists no pairs
+        // beyond the cutoff distance (or the sum of radii) except for those
+        // within the verlet skin.
+        md::neighbor_list<Box>& get_neighbor_list(md::system const& system, md::scalar& dcut2)
+        {
+            dcut2 = std::numeric_limits<md::scalar>::infinity();
+
+            if (radius_view_) {
+                neighbor_list_.update(
+                    system.view_positions(),
+                    radius_view_(system),
+                    derived().unit_cell(system)
+                );
+                return neighbor_list_;
+            }
+
+            auto const dcut = derived().neighbor_distance(system);
+
+            // A shared list is built with the largest cutoff distance among
+            // the forcefields sharing it.
+            if (registry_ && neighbor_list_.targets().empty()) {
+                dcut2 = dcut * dcut;
+                return registry_->update(system.view_positions(), dcut, derived().unit_cell(system));
+            }
+
+            neighbor_list_.update(system.view_positions(), dcut, derived().unit_cell(system));
             return neighbor_list_;
         }
 
@@ -117,6 +384,9 @@ namespace md
         }
 
         md::neighbor_list<Box> neighbor_list_;
+        std::shared_ptr<md::neighbor_list_registry<Box>> registry_;
+        md::index thread_count_ = 1;
+        std::function<md::array_view<md::scalar const>(md::system const&)> radius_view_;
     };
 
 
@@ -79,6 +79,64 @@ namespace md
             return {dx, dy, dz};
         }
     };
+
+    // Flags of periodic axes. Combine them with bitwise or to make the mask
+    // parameter of axis_periodic_box.
+    constexpr unsigned periodic_x = 1;
+    constexpr unsigned periodic_y = 2;
+    constexpr unsigned periodic_z = 4;
+
+    // axis_periodic_box represents a system periodic along the axes flagged in
+    // Mask and open along the other axes. Whether to wrap coordinates along
+    // each axis is decided at compile time.
+    //
+    // This covers the boundary conditions other than those of open_box,
+    // periodic_box and xy_periodic_box, e.g., z_periodic_box for a channel or
+    // a fiber. Neighbor search bins all axes like xy_periodic_box does.
+    template<unsigned Mask>
+    struct axis_periodic_box
+    {
+        static constexpr bool x_periodic = (Mask & periodic_x) != 0;
+        static constexpr bool y_periodic = (Mask & periodic_y) != 0;
+        static constexpr bool z_periodic = (Mask & periodic_z) != 0;
+
+        // Periods along the periodic axes. Ignored for open axes.
+        md::scalar x_period = 1;
+        md::scalar y_period = 1;
+        md::scalar z_period = 1;
+
+        // Approximate spans of the point cloud along the open axes. Ignored
+        // for periodic axes. These parameters affect the speed of neighbor
+        // search.
+        md::scalar x_span = 1;
+        md::scalar y_span = 1;
+        md::scalar z_span = 1;
+
+        // Approximate number of particles in the system. This parameter affects
+        // the speed of neighbor search.
+        md::index particle_count = 1000;
+
+        // Returns the shortest displacement vector pointing from p2 to p1
+        // taking into account the periodicity.
+        md::vector shortest_displacement(md::point p1, md::point p2) const
+        {
+            auto const dx = wrap<x_periodic>(p1.x - p2.x, x_period);
+            auto const dy = wrap<y_periodic>(p1.y - p2.y, y_period);
+            auto const dz = wrap<z_periodic>(p1.z - p2.z, z_period);
+            return {dx, dy, dz};
+        }
+
+    private:
+        template<bool Periodic>
+        static md::scalar wrap(md::scalar d, md::scalar period)
+        {
+            return Periodic ? nsearch_detail::round_mod(d, period) : d;
+        }
+    };
+
+    // z_periodic_box represents a system periodic along the z axis and open in
+    // the x and y directions.
+    using z_periodic_box = axis_periodic_box<periodic_z>;
 }
 
 #endif
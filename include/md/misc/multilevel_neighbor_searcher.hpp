@@ -0,0 +1,216 @@
+// Copyright snsinfu 2019.
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef MD_MISC_MULTILEVEL_NEIGHBOR_SEARCHER_HPP
+#define MD_MISC_MULTILEVEL_NEIGHBOR_SEARCHER_HPP
+
+// This module implements neighbor search for point clouds with per-point
+// interaction radii, such as mixtures of large and small particles.
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "../basic_types.hpp"
+
+#include "neighbor_search_options.hpp"
+#include "neighbor_searcher.hpp"
+
+
+namespace md
+{
+    // multilevel_neighbor_searcher finds pairs of points (i, j) within the
+    // distance r_i + r_j + margin, where r_i is the radius of point i.
+    //
+    // A single grid sized for the largest radii makes pairs of small points
+    // scan a far larger volume than needed. Instead, points are grouped into
+    // levels of radii differing by up to a factor of two, and each level has
+    // its own grid sized for the largest pair in the level. Pairs across
+    // levels are found by querying the points of a finer level against the
+    // grid of a coarser level.
+    template<typename Box>
+    class multilevel_neighbor_searcher
+    {
+    public:
+        // Constructor initializes search strategy using given information.
+        // Points are not set. The options are passed to the grid of each
+        // level.
+        explicit multilevel_neighbor_searcher(
+            Box box, md::scalar margin = 0, md::neighbor_search_options options = {}
+        )
+            : box_{box}, margin_{margin}, options_{options}
+        {
+        }
+
+        // Sets points to search and their radii.
+        void set_points(
+            md::array_view<md::point const> points,
+            md::array_view<md::scalar const> radii
+        )
+        {
+            assign_levels(radii);
+
+            for (auto& level : levels_) {
+                level.points.clear();
+                level.radii.clear();
+                for (auto const idx : level.indices) {
+                    level.points.push_back(points[idx]);
+                    level.radii.push_back(radii[idx]);
+                }
+
+                if (level.indices.empty()) {
+                    continue;
+                }
+
+                // Grids are expensive to reallocate, so reuse the previous
+                // one if it fits.
+                auto const dcut = 2 * level.max_radius + margin_;
+                if (level.searcher == no_searcher) {
+                    level.searcher = searchers_.size();
+                    searchers_.emplace_back(box_, dcut, options_);
+                } else if (level.dcut != dcut) {
+                    searchers_[level.searcher] = md::neighbor_searcher<Box>{box_, dcut, options_};
+                }
+                level.dcut = dcut;
+                searchers_[level.searcher].update_points(level.points);
+            }
+        }
+
+        // Returns the number of non-empty levels for the current points.
+        md::index level_count() const
+        {
+            return md::index(std::count_if(levels_.begin(), levels_.end(), [](radius_level const& level) {
+                return !level.indices.empty();
+            }));
+        }
+
+        // Searches neighboring points. Outputs pairs of indices of neighboring
+        // points to given output iterator. Each index pair (i, j) satisfies
+        // `i < j`. No duplicates are reported.
+        template<typename OutputIterator>
+        void search(OutputIterator out) const
+        {
+            std::vector<std::pair<md::index, md::index>> pairs;
+            std::vector<md::index> offsets;
+            std::vector<md::index> neighbors;
+
+            for (md::index fine = 0; fine < levels_.size(); fine++) {
+                auto const& fine_level = levels_[fine];
+
+                if (fine_level.indices.empty()) {
+                    continue;
+                }
+
+                // The grid of a level finds all pairs within the level, which
+                // are then filtered by the cutoff distance of each pair.
+                pairs.clear();
+                searchers_[fine_level.searcher].search(std::back_inserter(pairs));
+
+                for (auto const& pair : pairs) {
+                    output_if_within(fine_level, pair.first, fine_level, pair.second, out);
+                }
+
+                // The grid of a coarser level covers the pairs of its points
+                // and the points of finer levels.
+                for (md::index coarse = fine + 1; coarse < levels_.size(); coarse++) {
+                    auto const& coarse_level = levels_[coarse];
+
+                    if (coarse_level.indices.empty()) {
+                        continue;
+                    }
+
+                    searchers_[coarse_level.searcher].query(fine_level.points, offsets, neighbors);
+
+                    for (md::index k = 0; k < fine_level.points.size(); k++) {
+                        for (md::index n = offsets[k]; n < offsets[k + 1]; n++) {
+                            output_if_within(fine_level, k, coarse_level, neighbors[n], out);
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        // Points with radii in [r0 * 2^k, r0 * 2^(k+1)) are grouped into the
+        // level k, where r0 is the smallest radius. The grid of a level is
+        // searchers_[searcher] with cutoff distance dcut. Grids are created
+        // on demand, so searcher is no_searcher if the level has never been
+        // occupied.
+        static constexpr md::index no_searcher = md::index(-1);
+
+        struct radius_level
+        {
+            md::scalar max_radius = 0;
+            md::scalar dcut = 0;
+            md::index searcher = no_searcher;
+            std::vector<md::index> indices;
+            std::vector<md::point> points;
+            std::vector<md::scalar> radii;
+        };
+
+        // Groups points into levels by radius.
+        void assign_levels(md::array_view<md::scalar const> radii)
+        {
+            for (auto& level : levels_) {
+                level.indices.clear();
+                level.max_radius = 0;
+            }
+
+            if (radii.size() == 0) {
+                return;
+            }
+
+            auto const min_radius = *std::min_element(radii.begin(), radii.end());
+            auto const max_radius = *std::max_element(radii.begin(), radii.end());
+            auto const level_of = [&](md::scalar radius) {
+                if (min_radius <= 0 || radius <= min_radius) {
+                    return md::index(0);
+                }
+                return md::index(std::log2(radius / min_radius));
+            };
+
+            levels_.resize(std::max(levels_.size(), level_of(max_radius) + 1));
+
+            for (md::index idx = 0; idx < radii.size(); idx++) {
+                auto& level = levels_[level_of(radii[idx])];
+                level.indices.push_back(idx);
+                level.max_radius = std::max(level.max_radius, radii[idx]);
+            }
+        }
+
+        // Outputs the pair of the i-th point of level1 and the j-th point of
+        // level2 if they are within the cutoff distance of the pair.
+        template<typename OutputIterator>
+        inline void output_if_within(
+            radius_level const& level1,
+            md::index i,
+            radius_level const& level2,
+            md::index j,
+            OutputIterator& out
+        ) const
+        {
+            auto const dcut = level1.radii[i] + level2.radii[j] + margin_;
+            auto const disp = box_.shortest_displacement(level1.points[i], level2.points[j]);
+
+            if (disp.squared_norm() > dcut * dcut) {
+                return;
+            }
+
+            auto const index_i = level1.indices[i];
+            auto const index_j = level2.indices[j];
+
+            *out++ = std::make_pair(std::min(index_i, index_j), std::max(index_i, index_j));
+        }
+
+    private:
+        Box box_;
+        md::scalar margin_;
+        md::neighbor_search_options options_;
+        std::vector<radius_level> levels_;
+        std::vector<md::neighbor_searcher<Box>> searchers_;
+    };
+}
+
+#endif
@@ -0,0 +1,77 @@
+// Copyright snsinfu 2019.
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef MD_MISC_NEIGHBOR_SEARCH_OPTIONS_HPP
+#define MD_MISC_NEIGHBOR_SEARCH_OPTIONS_HPP
+
+// This module defines tuning parameters of neighbor_searcher.
+
+#include <cstdint>
+
+
+namespace md
+{
+    // How neighbor_searcher groups points into buckets in an open_box.
+    enum class open_grid_policy
+    {
+        // Hash cells into a fixed number of buckets, or bin the bounding box
+        // of the points if the point cloud is compact. Distinct cells may
+        // share a bucket.
+        adaptive,
+
+        // Give each occupied cell its own bucket using an exact hash table
+        // keyed by cell coordinates. Far-flung points never share a bucket
+        // with the main cluster.
+        exact_hash,
+    };
+
+    // Tuning parameters of neighbor_searcher. The defaults work well for
+    // typical simulations.
+    struct neighbor_search_options
+    {
+        // Number of cells per cutoff distance along each axis. The default
+        // grid uses cells as wide as the cutoff distance, and candidates are
+        // taken from the 27 cells around a point. Finer cells (2 or 3) make
+        // the candidate region hug the cutoff sphere more tightly, reducing
+        // distance tests at the cost of more cells. This pays off on dense
+        // systems. Hashed grids for sparse open systems ignore this.
+        std::uint32_t subdivision = 1;
+
+        // Bucketing policy for open_box.
+        md::open_grid_policy open_grid = md::open_grid_policy::adaptive;
+
+        // Store points in buckets as 32-bit indices and 32-bit fixed-point
+        // coordinates: 16 bytes per member instead of 32, halving the memory
+        // streamed by the pair search. The search results are the same: Pairs
+        // near the cutoff distance are rechecked with the exact coordinates
+        // passed to set_points or update_points, so these points must stay
+        // alive and unchanged while searching. The searcher falls back to the
+        // regular layout if the member arrays, which hold the points and some
+        // spare room, exceed 2^31 entries.
+        bool compact_members = false;
+
+        // Keep the tight bounding box of each bucket and skip neighboring
+        // buckets whose bounding box is farther than the cutoff distance.
+        // This pays off when buckets are sparsely or unevenly occupied.
+        bool prune_buckets = false;
+
+        // Keep the members of each bucket sorted by x coordinate, so that
+        // only the candidates within the cutoff distance along x are tested
+        // (sweep and prune). Periodic coordinates are stored wrapped into
+        // the box. Ignored with compact_members.
+        bool sort_members = false;
+
+        // Merge runs of sparse uniform bins along periodic axes, so that a
+        // phase separated system (e.g., a dense slab in a dilute box) does
+        // not spend time on many nearly empty buckets. Bin edges thus stay on
+        // the uniform grid and only roughly follow the point density. Bins
+        // are never narrower than the uniform ones, so dense regions are
+        // binned as usual. The bins are refitted when points redistribute.
+        // Open axes, such as z of xy_periodic_box, keep uniform bins, and
+        // open_box ignores this option.
+        bool adaptive_bins = false;
+    };
+}
+
+#endif
@@ -9,16 +9,38 @@
 // cloud in open and periodic systems.
 
 #include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
 #include <utility>
+#include <vector>
 
 #include "../basic_types.hpp"
 
+#include "neighbor_search_options.hpp"
+#include "parallel.hpp"
+#include "nsearch_detail/distance_kernel.hpp"
 #include "nsearch_detail/math.hpp"
+#include "nsearch_detail/quantize.hpp"
 #include "nsearch_detail/search_grid.hpp"
 
 
 namespace md
 {
+    // Counters of the work done by neighbor_searcher::search. The ratio of
+    // distance_evaluations to pairs tells how many candidate pairs are tested
+    // for each neighbor pair found.
+    struct neighbor_search_stats
+    {
+        // Number of candidate pairs tested against the cutoff distance.
+        md::index distance_evaluations = 0;
+
+        // Number of neighbor pairs found.
+        md::index pairs = 0;
+    };
+
     template<typename Box>
     class neighbor_searcher
     {
@@ -27,24 +49,151 @@ namespace md
     public:
         // Constructor initializes search strategy using given information.
         // Points are not set.
-        neighbor_searcher(Box box, md::scalar dcut)
-            : box_{box}, grid_{box, dcut}, dcut_{dcut}
+        neighbor_searcher(Box box, md::scalar dcut, md::neighbor_search_options options = {})
+            : box_{box}
+            , grid_{box, dcut, options}
+            , dcut_{dcut}
+            , prune_{options.prune_buckets}
+            , sorted_{options.sort_members && !options.compact_members}
+            , shifted_{has_periodic_axis() && !options.compact_members}
+            , compact_{options.compact_members}
         {
+            member_offsets_.assign(grid_.bucket_count(), 0);
+            bucket_sizes_.assign(grid_.bucket_count(), 0);
+            bucket_capacities_.assign(grid_.bucket_count(), 0);
         }
 
         // Sets points to search.
+        //
+        // Points are grouped by bucket into contiguous arrays using counting
+        // sort: The first pass counts points in each bucket, prefix sum gives
+        // the offset of each bucket, and the second pass scatters points to
+        // the arrays. No allocation happens once the buffers grow to the size
+        // of the point cloud. Coordinates are stored as separate x/y/z arrays
+        // for vectorized distance computation, or as fixed-point values with
+        // the compact_members option. With compact_members the searcher does
+        // not copy the exact coordinates: points must stay alive and
+        // unchanged until the next set_points or update_points call.
         void set_points(md::array_view<md::point const> points)
         {
-            for (auto& bucket : grid_.buckets) {
-                bucket.members.clear();
+            build_members(points, false);
+        }
+
+        // Updates points to search. The result is the same as set_points but
+        // this function is faster if only a few points move to a different
+        // bucket since the last call.
+        //
+        // Points staying in the same bucket are updated in place and the
+        // other points are moved to their new buckets. Buckets are laid out
+        // with some spare room to accept incoming points, and a bucket that
+        // runs out of room is relocated to the end of the member arrays with
+        // doubled capacity. The function falls back to set_points-like full
+        // rebuild if the number of points has changed, the grid has adapted
+        // its layout to the points, too many points move, or relocated buckets
+        // leave too much unused room in the arrays.
+        void update_points(md::array_view<md::point const> points)
+        {
+            // Rebuilding is faster than moving this many points.
+            md::index const max_migrants = points.size() / 4;
+            md::index const max_storage = 2 * (points.size() + grid_.bucket_count());
+
+            bool const layout_changed = grid_.fit(points);
+
+            if (layout_changed || points.size() != point_slots_.size() || member_count() > max_storage) {
+                build_members(points, true);
+                return;
+            }
+
+            // Points leaving the frame of the fixed-point encoding need a new
+            // frame.
+            if (compact_) {
+                exact_points_ = points;
+
+                for (auto const point : points) {
+                    if (!quantizer_.contains(point)) {
+                        build_members(points, true);
+                        return;
+                    }
+                }
             }
 
-            for (md::index index = 0; index < points.size(); index++) {
-                auto const point = points[index];
+            // The grid may have appended buckets for newly occupied cells, or
+            // dropped buckets after reshape. Dropped buckets are kept until
+            // their points move out.
+            grow_buckets();
+
+            migrants_.clear();
+
+            for (md::index idx = 0; idx < points.size(); idx++) {
+                auto const point = points[idx];
                 auto const bucket_index = grid_.locate_bucket(point);
-                auto& bucket = grid_.buckets[bucket_index];
-                bucket.members.push_back({ index, point });
+
+                if (bucket_index == point_buckets_[idx]) {
+                    store_member(point_slots_[idx], idx, point);
+                    continue;
+                }
+
+                if (migrants_.size() == max_migrants) {
+                    build_members(points, true);
+                    return;
+                }
+                migrants_.emplace_back(idx, bucket_index);
             }
+
+            for (auto const& migrant : migrants_) {
+                remove_member(migrant.first);
+            }
+
+            for (auto const& migrant : migrants_) {
+                auto const idx = migrant.first;
+                auto const bucket_index = migrant.second;
+
+                if (bucket_sizes_[bucket_index] == bucket_capacities_[bucket_index]) {
+                    if (!relocate_bucket(bucket_index)) {
+                        build_members(points, true);
+                        return;
+                    }
+                }
+
+                auto& size = bucket_sizes_[bucket_index];
+                auto const pos = member_offsets_[bucket_index] + size++;
+                max_bucket_size_ = std::max(max_bucket_size_, size);
+                point_buckets_[idx] = bucket_index;
+                store_member(pos, idx, points[idx]);
+            }
+
+            shrink_buckets();
+            index_members();
+        }
+
+        // Adapts the searcher to a changed box without constructing a new
+        // grid. Returns false if the box needs a new searcher, in which case
+        // this searcher is left unchanged. Call update_points afterwards to
+        // move the points to their buckets in the adapted grid before
+        // searching.
+        //
+        // This is useful for xy_periodic_box whose z_span changes as a film
+        // swells or shrinks: z layers are added or dropped at the edge and
+        // only the points in the affected layers are moved.
+        bool reshape(Box box)
+        {
+            using traits = nsearch_detail::box_traits<Box>;
+
+            // Fixed-point coordinates are relative to the periods.
+            if (compact_) {
+                auto const periods = traits::periods(box);
+                auto const prev_periods = traits::periods(box_);
+                if (periods.x != prev_periods.x || periods.y != prev_periods.y || periods.z != prev_periods.z) {
+                    return false;
+                }
+            }
+
+            if (!grid_.reshape(box)) {
+                return false;
+            }
+
+            box_ = box;
+            return true;
         }
 
         // Searches neighboring points. Outputs pairs of indices of neighboring
@@ -53,10 +202,43 @@ namespace md
         template<typename OutputIterator>
         void search(OutputIterator out) const
         {
-            for (auto const& bucket : grid_.buckets) {
-                for (auto const neighbor_index : bucket.directed_neighbors) {
-                    search_among(bucket, grid_.buckets[neighbor_index], out);
+            search_buckets(0, grid_.bucket_count(), out, nullptr);
+        }
+
+        // Same as above but also counts the work done by the search. stats
+        // is overwritten.
+        template<typename OutputIterator>
+        void search(OutputIterator out, md::neighbor_search_stats& stats) const
+        {
+            stats = {};
+            search_buckets(0, grid_.bucket_count(), out, &stats);
+        }
+
+        // Searches neighboring points using given number of threads. The
+        // buckets are split across threads, each of which collects pairs into
+        // its own buffer. The buffers are then concatenated into the output
+        // in bucket order, so the output is the same as the serial search.
+        template<typename OutputIterator>
+        void search(OutputIterator out, md::index thread_count) const
+        {
+            if (thread_count <= 1) {
+                search(out);
+                return;
+            }
+
+            using pair_type = std::pair<md::index, md::index>;
+            std::vector<std::vector<pair_type>> chunk_pairs(thread_count);
+
+            md::parallel_for_chunks(
+                thread_count,
+                grid_.bucket_count(),
+                [&](md::index chunk, md::index begin, md::index end) {
+                    search_buckets(begin, end, std::back_inserter(chunk_pairs[chunk]), nullptr);
                 }
+            );
+
+            for (auto const& pairs : chunk_pairs) {
+                out = std::copy(pairs.begin(), pairs.end(), out);
             }
         }
 
@@ -64,59 +246,1144 @@ namespace md
         template<typename OutputIterator>
         void query(md::point point, OutputIterator out) const
         {
-            auto const bucket_index = grid_.locate_bucket(point);
-            auto const& bucket = grid_.buckets[bucket_index];
-            query_around(bucket, point, out);
+            query_around(point, out);
         }
 
-    private:
-        // Searches a pair of buckets for neighboring pairs of points.
+        // Searches neighboring points of each of given probe points. Results
+        // are stored in compressed sparse row form: The indices of the points
+        // neighboring `probes[k]` are stored in `neighbors[offsets[k]]` to
+        // `neighbors[offsets[k + 1] - 1]`. `offsets` has `probes.size() + 1`
+        // elements.
+        //
+        // Probes are processed in the order of the bucket they fall in, so
+        // that points in each bucket are reused while they are in cache. The
+        // work is split across given number of threads.
+        void query(
+            md::array_view<md::point const> probes,
+            std::vector<md::index>& offsets,
+            std::vector<md::index>& neighbors,
+            md::index thread_count = 1
+        ) const
+        {
+            std::vector<md::index> order;
+            sort_probes(probes, order);
+
+            // Query each probe into per-thread buffers. The number of
+            // neighbors of each probe is recorded in offsets[k + 1].
+            std::vector<std::vector<md::index>> chunk_neighbors(
+                std::max(thread_count, md::index(1))
+            );
+            offsets.assign(probes.size() + 1, 0);
+
+            md::parallel_for_chunks(
+                thread_count,
+                probes.size(),
+                [&](md::index chunk, md::index begin, md::index end) {
+                    auto& buffer = chunk_neighbors[chunk];
+                    auto chunk_out = std::back_inserter(buffer);
+
+                    for (md::index rank = begin; rank < end; rank++) {
+                        auto const k = order[rank];
+                        auto const size = buffer.size();
+                        query_around(probes[k], chunk_out);
+                        offsets[k + 1] = buffer.size() - size;
+                    }
+                }
+            );
+
+            for (md::index k = 0; k < probes.size(); k++) {
+                offsets[k + 1] += offsets[k];
+            }
+
+            // Scatter the buffers to the output. The chunks are the same as
+            // above, so each thread reads its own buffer.
+            neighbors.resize(offsets.back());
+
+            md::parallel_for_chunks(
+                thread_count,
+                probes.size(),
+                [&](md::index chunk, md::index begin, md::index end) {
+                    auto src = chunk_neighbors[chunk].begin();
+
+                    for (md::index rank = begin; rank < end; rank++) {
+                        auto const k = order[rank];
+                        auto const size = offsets[k + 1] - offsets[k];
+                        std::copy(src, src + std::ptrdiff_t(size), neighbors.begin() + std::ptrdiff_t(offsets[k]));
+                        src += std::ptrdiff_t(size);
+                    }
+                }
+            );
+        }
+
+        // Searches points in the sphere of given center and radius. Outputs
+        // the indices of the points within the radius (inclusive) from the
+        // center to given output iterator. The radius may be arbitrarily
+        // large. The indices are not sorted.
+        //
+        // Only the buckets overlapping the bounding box of the sphere are
+        // scanned, so the cost is proportional to the volume of the region
+        // rather than the number of points.
+        template<typename OutputIterator>
+        void query_sphere(md::point center, md::scalar radius, OutputIterator out) const
+        {
+            if (radius < 0) {
+                return;
+            }
+
+            auto const reach = md::vector{radius, radius, radius};
+            auto const radius2 = radius * radius;
+
+            query_region(center - reach, center + reach, [&](md::point point) {
+                return squared_distance(point, center) <= radius2;
+            }, out);
+        }
+
+        // Searches points in the axis-aligned box [lower, upper]. Outputs the
+        // indices of the points in the box to given output iterator. Along a
+        // periodic axis the box may straddle the boundary of the periodic
+        // box, and points are tested with their periodic images. The indices
+        // are not sorted.
+        template<typename OutputIterator>
+        void query_box(md::point lower, md::point upper, OutputIterator out) const
+        {
+            using traits = nsearch_detail::box_traits<Box>;
+
+            if (!(lower.x <= upper.x && lower.y <= upper.y && lower.z <= upper.z)) {
+                return;
+            }
+
+            auto const period = traits::periods(box_);
+
+            // Tests if any image of coord is in [lo, hi] along an axis.
+            auto const within = [](bool periodic, md::scalar p, md::scalar coord, md::scalar lo, md::scalar hi) {
+                if (periodic) {
+                    return hi - lo >= p || nsearch_detail::floor_mod(coord - lo, p) <= hi - lo;
+                }
+                return lo <= coord && coord <= hi;
+            };
+
+            query_region(lower, upper, [&](md::point point) {
+                return within(traits::x_periodic, period.x, point.x, lower.x, upper.x)
+                    && within(traits::y_periodic, period.y, point.y, lower.y, upper.y)
+                    && within(traits::z_periodic, period.z, point.z, lower.z, upper.z);
+            }, out);
+        }
+
+        // Searches points in the slab z_lower <= z <= z_upper. Outputs the
+        // indices of the points in the slab to given output iterator. This is
+        // query_box unbounded along x and y.
+        template<typename OutputIterator>
+        void query_slab(md::scalar z_lower, md::scalar z_upper, OutputIterator out) const
+        {
+            auto const inf = std::numeric_limits<md::scalar>::infinity();
+            query_box({-inf, -inf, z_lower}, {inf, inf, z_upper}, out);
+        }
+
+        // Searches pairs of points between given probe points and the points
+        // set to the searcher (bipartite search). Outputs pairs (k, i) of the
+        // index k of a probe and the index i of a point within the cutoff
+        // distance. The pairs are not sorted.
+        //
+        // The grid is built only over the points set to the searcher and is
+        // not modified, so a static set of points can be set once and then
+        // searched against a moving set of probes. Probes are processed in
+        // the order of the bucket they fall in, and the work is split across
+        // given number of threads.
         template<typename OutputIterator>
-        inline void search_among(
-            nsearch_detail::spatial_bucket const& bucket_a,
-            nsearch_detail::spatial_bucket const& bucket_b,
-            OutputIterator& out
+        void search_bipartite(
+            md::array_view<md::point const> probes,
+            OutputIterator out,
+            md::index thread_count = 1
         ) const
         {
-            auto const dcut2 = dcut_ * dcut_;
+            using pair_type = std::pair<md::index, md::index>;
 
-            for (auto const member_j : bucket_b.members) {
-                for (auto const member_i : bucket_a.members) {
-                    if (member_i.index == member_j.index) {
-                        // Avoid double counting when bucket_a == bucket_b.
-                        break;
+            std::vector<md::index> order;
+            sort_probes(probes, order);
+
+            std::vector<std::vector<pair_type>> chunk_pairs(std::max(thread_count, md::index(1)));
+
+            md::parallel_for_chunks(
+                thread_count,
+                probes.size(),
+                [&](md::index chunk, md::index begin, md::index end) {
+                    auto filter = nsearch_detail::make_distance_filter(box_, {}, dcut_ * dcut_);
+                    std::vector<std::uint32_t> hits(max_bucket_size_);
+                    auto& pairs = chunk_pairs[chunk];
+
+                    for (md::index rank = begin; rank < end; rank++) {
+                        auto const k = order[rank];
+                        filter.center = probes[k];
+                        probe_around(filter, hits, [&](md::index idx) {
+                            pairs.emplace_back(k, idx);
+                        });
                     }
+                }
+            );
+
+            for (auto const& pairs : chunk_pairs) {
+                out = std::copy(pairs.begin(), pairs.end(), out);
+            }
+        }
+
+        // Searches k nearest neighbors of given point. Outputs the indices of
+        // the neighbors to given output iterator in the ascending order of
+        // distance. Outputs all points if there are no more than k points.
+        //
+        // Buckets are searched in shells of cells expanding outward from the
+        // cell containing the point until k neighbors are confirmed, so the
+        // search works regardless of the cutoff distance.
+        template<typename OutputIterator>
+        void knn(md::point point, md::index k, OutputIterator out) const
+        {
+            knn_state state;
+            knn_search(point, k, point_slots_.size(), state);
 
-                    if (squared_distance(member_i.point, member_j.point) > dcut2) {
+            for (auto const& candidate : state.heap) {
+                *out++ = candidate.second;
+            }
+        }
+
+        // Searches k nearest neighbors of every point, excluding the point
+        // itself. The indices of the neighbors of point i are stored in
+        // `neighbors[i * m]` to `neighbors[i * m + m - 1]` in the ascending
+        // order of distance, where `m = min(k, n - 1)` is returned. The work
+        // is split across given number of threads.
+        md::index knn_all(
+            md::index k,
+            std::vector<md::index>& neighbors,
+            md::index thread_count = 1
+        ) const
+        {
+            auto const point_count = point_slots_.size();
+            auto const m = std::min(k, point_count > 0 ? point_count - 1 : 0);
+
+            neighbors.resize(point_count * m);
+
+            md::parallel_for_chunks(
+                thread_count,
+                point_count,
+                [&](md::index, md::index begin, md::index end) {
+                    knn_state state;
+
+                    for (md::index idx = begin; idx < end; idx++) {
+                        auto const point = member_point(point_slots_[idx]);
+                        knn_search(point, m, idx, state);
+
+                        for (md::index rank = 0; rank < m; rank++) {
+                            neighbors[idx * m + rank] = state.heap[rank].second;
+                        }
+                    }
+                }
+            );
+
+            return m;
+        }
+
+    private:
+        // Working memory for k-nearest neighbor search.
+        struct knn_state
+        {
+            // Candidate (squared distance, index) pairs. This is a max-heap
+            // during search and sorted in ascending order after search.
+            std::vector<std::pair<md::scalar, md::index>> heap;
+
+            // Sorted indices of visited buckets, used when the grid may
+            // enumerate the same bucket more than once.
+            std::vector<md::index> visited;
+        };
+
+        // Searches k nearest neighbors of given point, skipping the point with
+        // index `excluded`. The result is stored in state.heap.
+        void knn_search(md::point point, md::index k, md::index excluded, knn_state& state) const
+        {
+            auto& heap = state.heap;
+            auto& visited = state.visited;
+
+            heap.clear();
+            visited.clear();
+
+            if (k == 0) {
+                return;
+            }
+
+            auto const width = grid_.shell_width();
+            md::index visited_points = 0;
+            md::index const total_points = point_slots_.size();
+
+            auto visit_bucket = [&](md::index bucket_index) {
+                if (!grid_type::unique_shell_buckets) {
+                    auto const pos = std::lower_bound(visited.begin(), visited.end(), bucket_index);
+                    if (pos != visited.end() && *pos == bucket_index) {
+                        return;
+                    }
+                    visited.insert(pos, bucket_index);
+                }
+
+                auto const begin = bucket_begin(bucket_index);
+                auto const end = bucket_end(bucket_index);
+                visited_points += end - begin;
+
+                for (md::index pos = begin; pos < end; pos++) {
+                    auto const idx = member_index(pos);
+                    if (idx == excluded) {
                         continue;
                     }
 
-                    *out++ = std::make_pair(
-                        std::min(member_i.index, member_j.index),
-                        std::max(member_i.index, member_j.index)
+                    auto const candidate = std::make_pair(
+                        squared_distance(member_point(pos), point), idx
                     );
+
+                    if (heap.size() < k) {
+                        heap.push_back(candidate);
+                        std::push_heap(heap.begin(), heap.end());
+                    } else if (candidate < heap.front()) {
+                        std::pop_heap(heap.begin(), heap.end());
+                        heap.back() = candidate;
+                        std::push_heap(heap.begin(), heap.end());
+                    }
+                }
+            };
+
+            for (std::uint32_t r = 0; ; r++) {
+                grid_.for_each_shell_bucket(point, r, visit_bucket);
+
+                // All points not yet visited are farther than r * width.
+                auto const reach = md::scalar(r) * width;
+                if (heap.size() == k && heap.front().first <= reach * reach) {
+                    break;
+                }
+
+                if (visited_points == total_points || grid_.covers_all(r)) {
+                    break;
+                }
+
+                if (!grid_type::unique_shell_buckets && visited.size() == grid_.bucket_count()) {
+                    break;
+                }
+            }
+
+            std::sort_heap(heap.begin(), heap.end());
+        }
+
+        // Groups points by bucket. If reserve_slack is true, some spare room
+        // is reserved in each bucket for incremental updates.
+        void build_members(md::array_view<md::point const> points, bool reserve_slack)
+        {
+            grid_.fit(points);
+
+            auto const bucket_count = grid_.bucket_count();
+
+            point_buckets_.resize(points.size());
+            point_slots_.resize(points.size());
+            bucket_sizes_.assign(bucket_count, 0);
+
+            for (md::index idx = 0; idx < points.size(); idx++) {
+                auto const bucket_index = grid_.locate_bucket(points[idx]);
+                point_buckets_[idx] = bucket_index;
+                bucket_sizes_[bucket_index]++;
+            }
+
+            member_offsets_.resize(bucket_count);
+            bucket_capacities_.resize(bucket_count);
+            max_bucket_size_ = 0;
+
+            md::index offset = 0;
+            for (md::index bucket = 0; bucket < bucket_count; bucket++) {
+                auto const size = bucket_sizes_[bucket];
+                auto const capacity = size + (reserve_slack ? 1 + size / 4 : 0);
+                member_offsets_[bucket] = offset;
+                bucket_capacities_[bucket] = capacity;
+                max_bucket_size_ = std::max(max_bucket_size_, size);
+                offset += capacity;
+            }
+
+            if (compact_ && offset > max_compact_members) {
+                drop_compact_members();
+            }
+
+            if (compact_) {
+                quantizer_ = nsearch_detail::quantizer<Box>{box_, points, dcut_};
+                exact_points_ = points;
+            }
+
+            resize_members(offset);
+
+            // Scatter in the ascending order of point index using the bucket
+            // sizes as insertion cursors.
+            std::fill(bucket_sizes_.begin(), bucket_sizes_.end(), 0);
+
+            for (md::index idx = 0; idx < points.size(); idx++) {
+                auto const bucket_index = point_buckets_[idx];
+                auto const pos = member_offsets_[bucket_index] + bucket_sizes_[bucket_index]++;
+                store_member(pos, idx, points[idx]);
+            }
+
+            index_members();
+        }
+
+        // Sorts the members of each bucket and computes the bounding boxes of
+        // the buckets as requested by the options.
+        void index_members()
+        {
+            if (sorted_) {
+                for (md::index bucket = 0; bucket < grid_.bucket_count(); bucket++) {
+                    sort_bucket(bucket);
+                }
+            }
+
+            if (prune_ || sorted_ || shifted_) {
+                compute_bounds();
+            }
+        }
+
+        // Sorts the members of a bucket by x coordinate. Buckets are mostly
+        // sorted after incremental updates, so sorted ones are skipped.
+        void sort_bucket(md::index bucket_index)
+        {
+            auto const begin = bucket_begin(bucket_index);
+            auto const end = bucket_end(bucket_index);
+            auto const xs = member_xs_.begin();
+
+            if (std::is_sorted(xs + std::ptrdiff_t(begin), xs + std::ptrdiff_t(end))) {
+                return;
+            }
+
+            sort_buffer_.clear();
+            for (md::index pos = begin; pos < end; pos++) {
+                sort_buffer_.emplace_back(member_xs_[pos], member_indices_[pos]);
+            }
+            std::sort(sort_buffer_.begin(), sort_buffer_.end());
+
+            // Coordinates are re-read from the slots the points occupied
+            // before sorting, so copy them out first.
+            point_buffer_.clear();
+            for (auto const& entry : sort_buffer_) {
+                point_buffer_.push_back(member_point(point_slots_[entry.second]));
+            }
+
+            for (md::index rank = 0; rank < sort_buffer_.size(); rank++) {
+                store_member(begin + rank, sort_buffer_[rank].second, point_buffer_[rank]);
+            }
+        }
+
+        // Computes the tight bounding box of each non-empty bucket. Periodic
+        // coordinates are wrapped into the box.
+        void compute_bounds()
+        {
+            bucket_bounds_.resize(grid_.bucket_count());
+
+            for (md::index bucket = 0; bucket < grid_.bucket_count(); bucket++) {
+                auto const begin = bucket_begin(bucket);
+                auto const end = bucket_end(bucket);
+
+                if (begin == end) {
+                    continue;
                 }
+
+                auto lower = canonical_point(member_point(begin));
+                auto upper = lower;
+
+                for (md::index pos = begin + 1; pos < end; pos++) {
+                    auto const point = canonical_point(member_point(pos));
+                    lower = {std::min(lower.x, point.x), std::min(lower.y, point.y), std::min(lower.z, point.z)};
+                    upper = {std::max(upper.x, point.x), std::max(upper.y, point.y), std::max(upper.z, point.z)};
+                }
+
+                auto const half_extent = (upper - lower) / 2;
+                bucket_bounds_[bucket] = {lower + half_extent, half_extent};
             }
         }
 
-        // Query neighboring points around the given bucket.
+        // Wraps the coordinates of a point along periodic axes into the box.
+        inline md::point canonical_point(md::point point) const
+        {
+            using traits = nsearch_detail::box_traits<Box>;
+
+            auto const period = traits::periods(box_);
+
+            if (traits::x_periodic) {
+                point.x = nsearch_detail::floor_mod(point.x, period.x);
+            }
+            if (traits::y_periodic) {
+                point.y = nsearch_detail::floor_mod(point.y, period.y);
+            }
+            if (traits::z_periodic) {
+                point.z = nsearch_detail::floor_mod(point.z, period.z);
+            }
+            return point;
+        }
+
+        // Adds empty buckets for the buckets appended to the grid. The new
+        // buckets have no room, so they are relocated on first insertion.
+        void grow_buckets()
+        {
+            auto const bucket_count = std::max(grid_.bucket_count(), member_offsets_.size());
+            member_offsets_.resize(bucket_count, member_count());
+            bucket_sizes_.resize(bucket_count, 0);
+            bucket_capacities_.resize(bucket_count, 0);
+        }
+
+        // Removes the buckets dropped from the grid. These buckets are empty
+        // once their points have moved to the remaining buckets.
+        void shrink_buckets()
+        {
+            auto const bucket_count = grid_.bucket_count();
+            member_offsets_.resize(bucket_count);
+            bucket_sizes_.resize(bucket_count);
+            bucket_capacities_.resize(bucket_count);
+        }
+
+        // Stores a point at given position of the member arrays.
+        inline void store_member(md::index pos, md::index idx, md::point point)
+        {
+            point_slots_[idx] = pos;
+
+            if (compact_) {
+                compact_indices_[pos] = std::uint32_t(idx);
+                quantizer_.encode(point, member_qxs_[pos], member_qys_[pos], member_qzs_[pos]);
+                return;
+            }
+
+            if (sorted_ || shifted_) {
+                point = canonical_point(point);
+            }
+
+            member_indices_[pos] = idx;
+            member_xs_[pos] = point.x;
+            member_ys_[pos] = point.y;
+            member_zs_[pos] = point.z;
+        }
+
+        // Moves a member to another position of the member arrays.
+        inline void move_member(md::index from, md::index to)
+        {
+            point_slots_[member_index(from)] = to;
+
+            if (compact_) {
+                compact_indices_[to] = compact_indices_[from];
+                member_qxs_[to] = member_qxs_[from];
+                member_qys_[to] = member_qys_[from];
+                member_qzs_[to] = member_qzs_[from];
+                return;
+            }
+
+            member_indices_[to] = member_indices_[from];
+            member_xs_[to] = member_xs_[from];
+            member_ys_[to] = member_ys_[from];
+            member_zs_[to] = member_zs_[from];
+        }
+
+        // Resizes the member arrays.
+        void resize_members(md::index size)
+        {
+            if (compact_) {
+                compact_indices_.resize(size);
+                member_qxs_.resize(size);
+                member_qys_.resize(size);
+                member_qzs_.resize(size);
+                return;
+            }
+
+            member_indices_.resize(size);
+            member_xs_.resize(size);
+            member_ys_.resize(size);
+            member_zs_.resize(size);
+        }
+
+        // Returns the size of the member arrays.
+        inline md::index member_count() const
+        {
+            return compact_ ? compact_indices_.size() : member_indices_.size();
+        }
+
+        // Returns the index of the point stored at given position of the
+        // member arrays.
+        inline md::index member_index(md::index pos) const
+        {
+            return compact_ ? compact_indices_[pos] : member_indices_[pos];
+        }
+
+        // Switches to the regular member arrays. Used if there are too many
+        // members for the compact ones.
+        void drop_compact_members()
+        {
+            compact_ = false;
+            shifted_ = has_periodic_axis();
+            compact_indices_ = {};
+            member_qxs_ = {};
+            member_qys_ = {};
+            member_qzs_ = {};
+            exact_points_ = {};
+        }
+
+        // Moves a bucket to the end of the member arrays, doubling its
+        // capacity. The room left behind is unused until the next rebuild.
+        // Returns false without moving the bucket if the compact member
+        // arrays would grow too large.
+        bool relocate_bucket(md::index bucket_index)
+        {
+            auto const old_offset = member_offsets_[bucket_index];
+            auto const new_offset = member_count();
+            auto const size = bucket_sizes_[bucket_index];
+            auto const capacity = 2 * bucket_capacities_[bucket_index] + 1;
+
+            if (compact_ && new_offset + capacity > max_compact_members) {
+                return false;
+            }
+
+            resize_members(new_offset + capacity);
+
+            for (md::index i = 0; i < size; i++) {
+                move_member(old_offset + i, new_offset + i);
+            }
+
+            member_offsets_[bucket_index] = new_offset;
+            bucket_capacities_[bucket_index] = capacity;
+            return true;
+        }
+
+        // Removes a point from its bucket by moving the last member of the
+        // bucket into the vacated position.
+        void remove_member(md::index idx)
+        {
+            auto const bucket_index = point_buckets_[idx];
+            auto const pos = point_slots_[idx];
+            auto const last = member_offsets_[bucket_index] + --bucket_sizes_[bucket_index];
+
+            move_member(last, pos);
+        }
+
+        // Returns the range of the member arrays occupied by a bucket.
+        inline md::index bucket_begin(md::index bucket_index) const
+        {
+            return member_offsets_[bucket_index];
+        }
+
+        inline md::index bucket_end(md::index bucket_index) const
+        {
+            return member_offsets_[bucket_index] + bucket_sizes_[bucket_index];
+        }
+
+        // Searches neighboring pairs of points in the buckets [begin, end)
+        // and their directed neighbors. Counts the work into stats if it is
+        // not null.
+        template<typename OutputIterator>
+        void search_buckets(
+            md::index begin,
+            md::index end,
+            OutputIterator out,
+            md::neighbor_search_stats* stats
+        ) const
+        {
+            search_filters filters = {
+                nsearch_detail::make_distance_filter(box_, {}, dcut_ * dcut_),
+                nsearch_detail::make_distance_filter(md::open_box{}, {}, dcut_ * dcut_)
+            };
+            auto quantized_filter = nsearch_detail::make_quantized_filter(quantizer_, dcut_ * dcut_);
+            std::vector<std::uint32_t> hits(max_bucket_size_);
+            std::vector<member_range> ranges;
+
+            for (md::index idx = begin; idx < end; idx++) {
+                if (bucket_sizes_[idx] == 0) {
+                    continue;
+                }
+
+                collect_neighbor_ranges(idx, ranges);
+
+                for (auto const& range : ranges) {
+                    if (range.end - range.begin > hits.size()) {
+                        hits.resize(range.end - range.begin);
+                    }
+                }
+
+                if (compact_) {
+                    search_around_compact(idx, ranges, filters.periodic, quantized_filter, hits, out, stats);
+                } else {
+                    search_around(idx, ranges, filters, hits, out, stats);
+                }
+            }
+        }
+
+        // Range of the member arrays to be tested against the members of a
+        // bucket. The members in the range are displaced by shift from the
+        // image of the bucket that is closest to them. If shifted is true,
+        // all pairs within the cutoff distance are between the bucket
+        // displaced by shift and the range, so the distances are plain
+        // differences without wrapping. If sweep is true, the range is
+        // sorted by x coordinate and [lower, upper) is the x window swept
+        // along the range.
+        struct member_range
+        {
+            md::index begin;
+            md::index end;
+            md::vector shift;
+            bool shifted;
+            bool sweep;
+            md::index lower;
+            md::index upper;
+        };
+
+        // Distance filters for member ranges that need wrapping and those
+        // that do not.
+        struct search_filters
+        {
+            nsearch_detail::distance_filter periodic;
+            nsearch_detail::distance_filter shifted;
+        };
+
+        // Collects the ranges of the member arrays occupied by the directed
+        // neighbors of a bucket. The first range is the bucket itself.
+        // Neighbors stored back to back are merged into a single range. This
+        // way fine-grained grids, where a bucket has many small neighbors, do
+        // not pay for the overhead of testing each neighbor separately.
+        //
+        // Neighbors whose bounding box is beyond the cutoff distance are
+        // skipped with the prune_buckets option. Sorted neighbors are not
+        // merged as the sort order is per bucket.
+        void collect_neighbor_ranges(md::index bucket_index, std::vector<member_range>& ranges) const
+        {
+            ranges.clear();
+            ranges.push_back(make_member_range(bucket_index, bucket_index));
+
+            grid_.for_each_directed_neighbor(bucket_index, [&](md::index neighbor_index) {
+                if (neighbor_index == bucket_index) {
+                    return;
+                }
+
+                auto const begin = bucket_begin(neighbor_index);
+                auto const end = bucket_end(neighbor_index);
+
+                if (begin == end) {
+                    return;
+                }
+
+                if (prune_ && bounds_gap2(bucket_index, neighbor_index) > dcut_ * dcut_) {
+                    return;
+                }
+
+                auto const range = make_member_range(bucket_index, neighbor_index);
+
+                if (!sorted_ && ranges.size() > 1 && can_merge(ranges.back(), range)) {
+                    ranges.back().end = end;
+                } else {
+                    ranges.push_back(range);
+                }
+            });
+        }
+
+        // Returns true if range2 stored right after range1 can be tested
+        // along with range1 in a single kernel call.
+        static bool can_merge(member_range const& range1, member_range const& range2)
+        {
+            if (range1.end != range2.begin || range1.shifted != range2.shifted) {
+                return false;
+            }
+            return !range1.shifted || (
+                range1.shift.x == range2.shift.x &&
+                range1.shift.y == range2.shift.y &&
+                range1.shift.z == range2.shift.z
+            );
+        }
+
+        // Creates the member range of a neighbor of a bucket.
+        //
+        // Members are stored wrapped into the box when sorted or shifted, so
+        // the image of the neighbor closest to the bucket is the same for all
+        // pairs of their members within the cutoff distance, as long as the
+        // bounding boxes extended by the cutoff distance are narrower than
+        // half the period. That image is precomputed here once per link.
+        member_range make_member_range(md::index bucket_index, md::index neighbor_index) const
+        {
+            using traits = nsearch_detail::box_traits<Box>;
+
+            auto const begin = bucket_begin(neighbor_index);
+            auto const end = bucket_end(neighbor_index);
+            member_range range = {begin, end, {}, false, false, begin, begin};
+
+            if (!sorted_ && !shifted_) {
+                return range;
+            }
+
+            auto const period = traits::periods(box_);
+            auto const& bounds = bucket_bounds_[bucket_index];
+            auto const& neighbor_bounds = bucket_bounds_[neighbor_index];
+            auto const delta = neighbor_bounds.center - bounds.center;
+            auto const reach = bounds.half_extent + neighbor_bounds.half_extent;
+            auto const margin = sweep_reach();
+
+            auto const unique_image = [&](md::scalar r, md::scalar p) {
+                return r + margin < p / 2;
+            };
+            // Bounding boxes are in the box, so |d| < p.
+            auto const image_shift = [&](md::scalar d, md::scalar p) {
+                return d > p / 2 ? p : d < -p / 2 ? -p : 0;
+            };
+
+            bool const x_unique = !traits::x_periodic || unique_image(reach.x, period.x);
+            bool const y_unique = !traits::y_periodic || unique_image(reach.y, period.y);
+            bool const z_unique = !traits::z_periodic || unique_image(reach.z, period.z);
+
+            if (traits::x_periodic) {
+                range.shift.x = image_shift(delta.x, period.x);
+            }
+            if (traits::y_periodic) {
+                range.shift.y = image_shift(delta.y, period.y);
+            }
+            if (traits::z_periodic) {
+                range.shift.z = image_shift(delta.z, period.z);
+            }
+
+            // The x window misses other images of the neighbor if the buckets
+            // are wide compared to the period.
+            range.shifted = shifted_ && x_unique && y_unique && z_unique;
+            range.sweep = sorted_ && x_unique;
+
+            return range;
+        }
+
+        // Returns true if the box has a periodic axis.
+        static constexpr bool has_periodic_axis()
+        {
+            using traits = nsearch_detail::box_traits<Box>;
+            return traits::x_periodic || traits::y_periodic || traits::z_periodic;
+        }
+
+        // Computes the squared distance between the bounding boxes of two
+        // buckets. This is a lower bound of the distance between the members
+        // of the buckets, slightly shrunk to absorb rounding errors.
+        md::scalar bounds_gap2(md::index bucket_index, md::index neighbor_index) const
+        {
+            auto const& bounds = bucket_bounds_[bucket_index];
+            auto const& neighbor_bounds = bucket_bounds_[neighbor_index];
+            auto const delta = box_.shortest_displacement(neighbor_bounds.center, bounds.center);
+            auto const extent = bounds.half_extent + neighbor_bounds.half_extent;
+            auto const tolerance = sweep_reach() - dcut_;
+
+            auto const gap = [=](md::scalar d, md::scalar h) {
+                return std::max(std::fabs(d) - h - tolerance, md::scalar(0));
+            };
+            auto const gap_x = gap(delta.x, extent.x);
+            auto const gap_y = gap(delta.y, extent.y);
+            auto const gap_z = gap(delta.z, extent.z);
+
+            return gap_x * gap_x + gap_y * gap_y + gap_z * gap_z;
+        }
+
+        // Returns the half width of the x window swept around each member,
+        // which is the cutoff distance plus a small tolerance for rounding.
+        inline md::scalar sweep_reach() const
+        {
+            return dcut_ * (1 + 1e-9);
+        }
+
+        // Slides the x window of a sorted member range to the members within
+        // the cutoff distance from x along x. The members of the bucket are
+        // visited in the ascending order of x, so the window only moves
+        // forward.
+        inline void sweep_range(member_range& range, md::index end, md::scalar x) const
+        {
+            auto const center = x + range.shift.x;
+            auto const reach = sweep_reach();
+
+            while (range.lower < end && member_xs_[range.lower] < center - reach) {
+                range.lower++;
+            }
+
+            range.upper = std::max(range.upper, range.lower);
+
+            while (range.upper < end && member_xs_[range.upper] <= center + reach) {
+                range.upper++;
+            }
+        }
+
+        // Searches neighboring pairs of points between a bucket and itself
+        // and between the bucket and given ranges of the member arrays. The
+        // first range is the bucket itself.
+        template<typename OutputIterator>
+        inline void search_around(
+            md::index bucket_index,
+            std::vector<member_range>& ranges,
+            search_filters& filters,
+            std::vector<std::uint32_t>& hits,
+            OutputIterator& out,
+            md::neighbor_search_stats* stats
+        ) const
+        {
+            auto const begin = bucket_begin(bucket_index);
+            auto const end = bucket_end(bucket_index);
+
+            for (md::index j = begin; j < end; j++) {
+                auto const center = member_point(j);
+                filters.periodic.center = center;
+
+                for (md::index r = 0; r < ranges.size(); r++) {
+                    auto& range = ranges[r];
+
+                    // Avoid double counting within the bucket.
+                    auto const range_end = (r == 0 ? j : range.end);
+                    auto range_begin = range.begin;
+                    auto range_stop = range_end;
+
+                    if (range.sweep) {
+                        sweep_range(range, range_end, center.x);
+                        range_begin = range.lower;
+                        range_stop = range.upper;
+                    }
+
+                    if (range.shifted) {
+                        filters.shifted.center = center + range.shift;
+                        search_range<md::open_box>(j, range_begin, range_stop, filters.shifted, hits, out, stats);
+                    } else {
+                        search_range<Box>(j, range_begin, range_stop, filters.periodic, hits, out, stats);
+                    }
+                }
+            }
+        }
+
+        // Outputs the pairs of the member j and members in [begin, end) that
+        // pass the filter centered at the member j. The filter wraps the
+        // distances along the periodic axes of KernelBox.
+        template<typename KernelBox, typename OutputIterator>
+        inline void search_range(
+            md::index j,
+            md::index begin,
+            md::index end,
+            nsearch_detail::distance_filter const& filter,
+            std::vector<std::uint32_t>& hits,
+            OutputIterator& out,
+            md::neighbor_search_stats* stats
+        ) const
+        {
+            auto const hit_count = nsearch_detail::filter_within<KernelBox>(
+                filter,
+                member_xs_.data(),
+                member_ys_.data(),
+                member_zs_.data(),
+                begin,
+                end,
+                hits.data()
+            );
+
+            if (stats) {
+                stats->distance_evaluations += end - begin;
+                stats->pairs += hit_count;
+            }
+
+            auto const index_j = member_indices_[j];
+
+            for (md::index hit = 0; hit < hit_count; hit++) {
+                auto const index_i = member_indices_[hits[hit]];
+                *out++ = std::make_pair(
+                    std::min(index_i, index_j),
+                    std::max(index_i, index_j)
+                );
+            }
+        }
+
+        // Same as search_around but for compact members. The conservative
+        // test on fixed-point coordinates may pass pairs slightly beyond the
+        // cutoff distance, so pairs near the boundary are rechecked with the
+        // exact coordinates.
         template<typename OutputIterator>
-        inline void query_around(
-            nsearch_detail::spatial_bucket const& bucket,
-            md::point point,
-            OutputIterator& out
+        inline void search_around_compact(
+            md::index bucket_index,
+            std::vector<member_range> const& ranges,
+            nsearch_detail::distance_filter& filter,
+            nsearch_detail::quantized_filter& quantized_filter,
+            std::vector<std::uint32_t>& hits,
+            OutputIterator& out,
+            md::neighbor_search_stats* stats
+        ) const
+        {
+            auto const begin = bucket_begin(bucket_index);
+            auto const end = bucket_end(bucket_index);
+
+            for (md::index j = begin; j < end; j++) {
+                quantized_filter.center_x = member_qxs_[j];
+                quantized_filter.center_y = member_qys_[j];
+                quantized_filter.center_z = member_qzs_[j];
+
+                for (md::index r = 0; r < ranges.size(); r++) {
+                    // Avoid double counting within the bucket.
+                    auto const range_end = (r == 0 ? j : ranges[r].end);
+
+                    search_range_compact(
+                        j, ranges[r].begin, range_end, filter, quantized_filter, hits, out, stats
+                    );
+                }
+            }
+        }
+
+        // Outputs the pairs of the compact member j and compact members in
+        // [begin, end) that are within the cutoff distance.
+        template<typename OutputIterator>
+        inline void search_range_compact(
+            md::index j,
+            md::index begin,
+            md::index end,
+            nsearch_detail::distance_filter& filter,
+            nsearch_detail::quantized_filter const& quantized_filter,
+            std::vector<std::uint32_t>& hits,
+            OutputIterator& out,
+            md::neighbor_search_stats* stats
+        ) const
+        {
+            auto const hit_count = nsearch_detail::filter_within_quantized<Box>(
+                quantized_filter,
+                member_qxs_.data(),
+                member_qys_.data(),
+                member_qzs_.data(),
+                begin,
+                end,
+                hits.data()
+            );
+
+            if (stats) {
+                stats->distance_evaluations += end - begin;
+            }
+
+            md::index const index_j = compact_indices_[j];
+
+            for (md::index hit = 0; hit < hit_count; hit++) {
+                auto const pos = hits[hit] & ~nsearch_detail::uncertain_hit;
+                md::index const index_i = compact_indices_[pos];
+
+                if (hits[hit] & nsearch_detail::uncertain_hit) {
+                    filter.center = exact_points_[index_j];
+                    auto const point_i = exact_points_[index_i];
+                    auto const exact_d2 = nsearch_detail::squared_distance_from_center<Box>(
+                        filter, point_i.x, point_i.y, point_i.z
+                    );
+                    if (exact_d2 > filter.dcut2) {
+                        continue;
+                    }
+                }
+
+                if (stats) {
+                    stats->pairs++;
+                }
+
+                *out++ = std::make_pair(
+                    std::min(index_i, index_j),
+                    std::max(index_i, index_j)
+                );
+            }
+        }
+
+        // Sorts probes by bucket using counting sort. order is filled with
+        // the indices of the probes in the ascending order of bucket index.
+        // The grid may locate a probe at bucket_count if no bucket covers the
+        // probe.
+        void sort_probes(md::array_view<md::point const> probes, std::vector<md::index>& order) const
+        {
+            auto const bucket_count = grid_.bucket_count();
+
+            std::vector<md::index> probe_buckets(probes.size());
+            std::vector<md::index> bucket_starts(bucket_count + 2, 0);
+            order.resize(probes.size());
+
+            for (md::index k = 0; k < probes.size(); k++) {
+                auto const bucket_index = grid_.locate_bucket(probes[k]);
+                probe_buckets[k] = bucket_index;
+                bucket_starts[bucket_index + 1]++;
+            }
+
+            for (md::index bucket = 0; bucket <= bucket_count; bucket++) {
+                bucket_starts[bucket + 1] += bucket_starts[bucket];
+            }
+
+            for (md::index k = 0; k < probes.size(); k++) {
+                order[bucket_starts[probe_buckets[k]]++] = k;
+            }
+        }
+
+        // Calls fn with the index of each point within the cutoff distance
+        // (inclusive) from the center of filter. Candidates are tested with
+        // the vectorized kernel, or with exact coordinates if members are
+        // compact.
+        template<typename Function>
+        inline void probe_around(
+            nsearch_detail::distance_filter const& filter,
+            std::vector<std::uint32_t>& hits,
+            Function fn
         ) const
+        {
+            grid_.for_each_adjacent_bucket(filter.center, [&](md::index neighbor_index) {
+                auto const begin = bucket_begin(neighbor_index);
+                auto const end = bucket_end(neighbor_index);
+
+                if (compact_) {
+                    for (md::index pos = begin; pos < end; pos++) {
+                        if (squared_distance(member_point(pos), filter.center) <= filter.dcut2) {
+                            fn(member_index(pos));
+                        }
+                    }
+                    return;
+                }
+
+                if (end - begin > hits.size()) {
+                    hits.resize(end - begin);
+                }
+
+                auto const hit_count = nsearch_detail::filter_within<Box>(
+                    filter,
+                    member_xs_.data(),
+                    member_ys_.data(),
+                    member_zs_.data(),
+                    begin,
+                    end,
+                    hits.data()
+                );
+
+                for (md::index hit = 0; hit < hit_count; hit++) {
+                    fn(member_indices_[hits[hit]]);
+                }
+            });
+        }
+
+        // Query neighboring points in the buckets adjacent to given point.
+        template<typename OutputIterator>
+        inline void query_around(md::point point, OutputIterator& out) const
         {
             auto const dcut2 = dcut_ * dcut_;
 
-            for (auto const neighbor_index : bucket.complete_neighbors) {
-                auto const& neighbor = grid_.buckets[neighbor_index];
-                for (auto const member : neighbor.members) {
-                    if (squared_distance(member.point, point) < dcut2) {
-                        *out++ = member.index;
+            grid_.for_each_adjacent_bucket(point, [&](md::index neighbor_index) {
+                auto const begin = bucket_begin(neighbor_index);
+                auto const end = bucket_end(neighbor_index);
+
+                for (md::index pos = begin; pos < end; pos++) {
+                    if (squared_distance(member_point(pos), point) < dcut2) {
+                        *out++ = member_index(pos);
                     }
                 }
+            });
+        }
+
+        // Outputs the indices of the points passing inside test in the buckets
+        // overlapping the axis-aligned box [lower, upper].
+        template<typename Inside, typename OutputIterator>
+        void query_region(md::point lower, md::point upper, Inside inside, OutputIterator& out) const
+        {
+            grid_.for_each_region_bucket(lower, upper, [&](md::index bucket_index) {
+                auto const begin = bucket_begin(bucket_index);
+                auto const end = bucket_end(bucket_index);
+
+                for (md::index pos = begin; pos < end; pos++) {
+                    if (inside(member_point(pos))) {
+                        *out++ = member_index(pos);
+                    }
+                }
+            });
+        }
+
+        // Returns the point stored at given position of the member arrays.
+        inline md::point member_point(md::index pos) const
+        {
+            if (compact_) {
+                return exact_points_[compact_indices_[pos]];
             }
+            return {member_xs_[pos], member_ys_[pos], member_zs_[pos]};
         }
 
         inline md::scalar squared_distance(md::point p1, md::point p2) const
@@ -128,6 +1395,44 @@ namespace md
         Box box_;
         grid_type grid_;
         md::scalar dcut_;
+        md::index max_bucket_size_ = 0;
+        std::vector<md::index> member_offsets_;
+        std::vector<md::index> bucket_sizes_;
+        std::vector<md::index> bucket_capacities_;
+        std::vector<md::index> member_indices_;
+        std::vector<md::scalar> member_xs_;
+        std::vector<md::scalar> member_ys_;
+        std::vector<md::scalar> member_zs_;
+
+        // Bucket pruning, sorting and image shifts: Bounding boxes of buckets
+        // in wrapped coordinates, and scratch buffers for sorting.
+        struct bucket_bounds
+        {
+            md::point center;
+            md::vector half_extent;
+        };
+        bool prune_;
+        bool sorted_;
+        bool shifted_;
+        std::vector<bucket_bounds> bucket_bounds_;
+        std::vector<std::pair<md::scalar, md::index>> sort_buffer_;
+        std::vector<md::point> point_buffer_;
+
+        // Compact members: 32-bit indices and fixed-point coordinates. Exact
+        // coordinates are read from the caller's points for rechecking.
+        // Quantized distance tests encode member positions in 31 bits, which
+        // limits the size of the compact member arrays.
+        static constexpr md::index max_compact_members = md::index(1) << 31;
+        bool compact_;
+        nsearch_detail::quantizer<Box> quantizer_;
+        std::vector<std::uint32_t> compact_indices_;
+        std::vector<std::uint32_t> member_qxs_;
+        std::vector<std::uint32_t> member_qys_;
+        std::vector<std::uint32_t> member_qzs_;
+        md::array_view<md::point const> exact_points_;
+        std::vector<md::index> point_buckets_;
+        std::vector<md::index> point_slots_;
+        std::vector<std::pair<md::index, md::index>> migrants_;
     };
 }
 
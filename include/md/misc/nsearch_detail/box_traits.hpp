@@ -0,0 +1,83 @@
+// Copyright snsinfu 2019.
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef MD_MISC_NSEARCH_DETAIL_BOX_TRAITS_HPP
+#define MD_MISC_NSEARCH_DETAIL_BOX_TRAITS_HPP
+
+// This module defines box_traits: compile-time description of the periodicity
+// of standard boxes. Used to specialize inner loops of neighbor search.
+
+#include "../../basic_types.hpp"
+#include "../box.hpp"
+
+
+namespace md
+{
+    namespace nsearch_detail
+    {
+        // box_traits tells which axes of a box are periodic. `periods` returns
+        // the periods along the axes, which are meaningful only for periodic
+        // axes.
+        template<typename Box>
+        struct box_traits;
+
+        template<>
+        struct box_traits<md::open_box>
+        {
+            static constexpr bool x_periodic = false;
+            static constexpr bool y_periodic = false;
+            static constexpr bool z_periodic = false;
+
+            static md::vector periods(md::open_box const&)
+            {
+                return {};
+            }
+        };
+
+        template<>
+        struct box_traits<md::periodic_box>
+        {
+            static constexpr bool x_periodic = true;
+            static constexpr bool y_periodic = true;
+            static constexpr bool z_periodic = true;
+
+            static md::vector periods(md::periodic_box const& box)
+            {
+                return {box.x_period, box.y_period, box.z_period};
+            }
+        };
+
+        template<>
+        struct box_traits<md::xy_periodic_box>
+        {
+            static constexpr bool x_periodic = true;
+            static constexpr bool y_periodic = true;
+            static constexpr bool z_periodic = false;
+
+            static md::vector periods(md::xy_periodic_box const& box)
+            {
+                return {box.x_period, box.y_period, 0};
+            }
+        };
+
+        template<unsigned Mask>
+        struct box_traits<md::axis_periodic_box<Mask>>
+        {
+            static constexpr bool x_periodic = md::axis_periodic_box<Mask>::x_periodic;
+            static constexpr bool y_periodic = md::axis_periodic_box<Mask>::y_periodic;
+            static constexpr bool z_periodic = md::axis_periodic_box<Mask>::z_periodic;
+
+            static md::vector periods(md::axis_periodic_box<Mask> const& box)
+            {
+                return {
+                    x_periodic ? box.x_period : 0,
+                    y_periodic ? box.y_period : 0,
+                    z_periodic ? box.z_period : 0
+                };
+            }
+        };
+    }
+}
+
+#endif
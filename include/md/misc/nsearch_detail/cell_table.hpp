@@ -0,0 +1,173 @@
+// Copyright snsinfu 2019.
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef MD_MISC_NSEARCH_DETAIL_CELL_TABLE_HPP
+#define MD_MISC_NSEARCH_DETAIL_CELL_TABLE_HPP
+
+// This module defines cell_table: an exact hash table that maps the integral
+// coordinates of grid cells to consecutive bucket indices.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace md
+{
+    namespace nsearch_detail
+    {
+        using std::int64_t;
+        using std::uint64_t;
+        using std::size_t;
+
+        // Bucket index returned by cell_table::find for a cell not in the
+        // table.
+        constexpr size_t no_bucket = size_t(-1);
+
+        // cell_table assigns bucket indices 0, 1, 2, ... to distinct cells in
+        // the order of insertion. Cell coordinates are packed into a 63-bit
+        // key of three 21-bit two's complement fields. Keys are distinct for
+        // coordinates in [-2^20, 2^20), which in_range tests; cells outside
+        // the range must not be inserted. Shifted keys wrap around modulo
+        // 2^21, so the neighbors of a cell at the edge of the range are
+        // looked up on the opposite edge, which only adds candidates.
+        //
+        // Keys are stored in an open-addressing table with linear probing.
+        // The table is kept at most half full.
+        class cell_table
+        {
+        public:
+            // Packs cell coordinates into a key.
+            static uint64_t make_key(int64_t x, int64_t y, int64_t z)
+            {
+                return (uint64_t(x) & coord_mask)
+                    | (uint64_t(y) & coord_mask) << coord_bits
+                    | (uint64_t(z) & coord_mask) << (2 * coord_bits);
+            }
+
+            // Returns true if the cell coordinates are representable without
+            // aliasing.
+            static bool in_range(int64_t x, int64_t y, int64_t z)
+            {
+                auto const in_field = [](int64_t c) {
+                    return c >= -coord_limit && c < coord_limit;
+                };
+                return in_field(x) && in_field(y) && in_field(z);
+            }
+
+            // Returns the key of the cell displaced from the cell of given key
+            // by (dx, dy, dz), wrapping around each field. Offsets must be
+            // within (-2^20, 2^20).
+            static uint64_t shift_key(uint64_t key, int64_t dx, int64_t dy, int64_t dz)
+            {
+                return make_key(
+                    field(key, 0) + dx,
+                    field(key, 1) + dy,
+                    field(key, 2) + dz
+                );
+            }
+
+            // Returns the number of cells in the table.
+            size_t size() const
+            {
+                return keys_.size();
+            }
+
+            // Returns the key of the cell assigned to given bucket index.
+            uint64_t key(size_t bucket) const
+            {
+                return keys_[bucket];
+            }
+
+            // Removes all cells.
+            void clear()
+            {
+                keys_.clear();
+                slots_.clear();
+            }
+
+            // Returns the bucket index of the cell, or no_bucket if the cell
+            // is not in the table.
+            size_t find(uint64_t key) const
+            {
+                if (slots_.empty()) {
+                    return no_bucket;
+                }
+
+                for (size_t slot = locate_slot(key); ; slot = (slot + 1) & slot_mask()) {
+                    auto const bucket = slots_[slot];
+                    if (bucket == empty_slot) {
+                        return no_bucket;
+                    }
+                    if (keys_[bucket] == key) {
+                        return bucket;
+                    }
+                }
+            }
+
+            // Inserts a cell that is not in the table and returns the bucket
+            // index assigned to the cell.
+            size_t insert(uint64_t key)
+            {
+                if (2 * (keys_.size() + 1) > slots_.size()) {
+                    rehash(slots_.empty() ? min_slots : 2 * slots_.size());
+                }
+
+                auto const bucket = keys_.size();
+                keys_.push_back(key);
+                place(bucket);
+                return bucket;
+            }
+
+        private:
+            static constexpr unsigned coord_bits = 21;
+            static constexpr uint64_t coord_mask = (uint64_t(1) << coord_bits) - 1;
+            static constexpr uint64_t sign_bit = uint64_t(1) << (coord_bits - 1);
+            static constexpr int64_t coord_limit = int64_t(1) << (coord_bits - 1);
+            static constexpr size_t min_slots = 64;
+            static constexpr std::uint32_t empty_slot = std::uint32_t(-1);
+
+            // Extracts the n-th field of the key as a signed coordinate.
+            static int64_t field(uint64_t key, unsigned n)
+            {
+                auto const bits = (key >> (n * coord_bits)) & coord_mask;
+                return int64_t(bits ^ sign_bit) - coord_limit;
+            }
+
+            size_t slot_mask() const
+            {
+                return slots_.size() - 1;
+            }
+
+            // Fibonacci hashing spreads the packed fields over the slots.
+            size_t locate_slot(uint64_t key) const
+            {
+                return size_t((key * 0x9E3779B97F4A7C15) >> 32) & slot_mask();
+            }
+
+            void place(size_t bucket)
+            {
+                auto slot = locate_slot(keys_[bucket]);
+                while (slots_[slot] != empty_slot) {
+                    slot = (slot + 1) & slot_mask();
+                }
+                slots_[slot] = std::uint32_t(bucket);
+            }
+
+            void rehash(size_t slot_count)
+            {
+                std::uint32_t const empty = empty_slot; // Avoid ODR-use.
+                slots_.assign(slot_count, empty);
+                for (size_t bucket = 0; bucket < keys_.size(); bucket++) {
+                    place(bucket);
+                }
+            }
+
+            std::vector<uint64_t> keys_;
+            std::vector<std::uint32_t> slots_;
+        };
+    }
+}
+
+#endif
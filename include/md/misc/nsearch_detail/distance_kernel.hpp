@@ -0,0 +1,312 @@
+// Copyright snsinfu 2019.
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef MD_MISC_NSEARCH_DETAIL_DISTANCE_KERNEL_HPP
+#define MD_MISC_NSEARCH_DETAIL_DISTANCE_KERNEL_HPP
+
+// This module implements the innermost loop of neighbor search: Testing many
+// candidate points, stored as separate x/y/z arrays, against a cutoff distance
+// from a center point and compressing the indices of hits into an array.
+//
+// The kernel is vectorized with AVX-512, AVX or SSE2 intrinsics, chosen at
+// compile time from the instruction sets enabled for the compiler (e.g., by
+// -march=native). Define MD_NO_SIMD to force the portable scalar kernel.
+
+#include <cmath>
+#include <cstdint>
+
+#include "../../basic_types.hpp"
+#include "box_traits.hpp"
+
+#if !defined(MD_NO_SIMD) && (defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__))
+# include <immintrin.h>
+#endif
+
+
+namespace md
+{
+    namespace nsearch_detail
+    {
+        using std::uint32_t;
+
+        // distance_filter holds the parameters of a cutoff distance test.
+        struct distance_filter
+        {
+            md::point center;
+            md::vector period;
+            md::vector inv_period;
+            md::scalar dcut2;
+        };
+
+        // Creates a distance_filter that tests if points are within squared
+        // distance dcut2 (inclusive) from the center in given box.
+        template<typename Box>
+        distance_filter make_distance_filter(
+            Box const& box, md::point center, md::scalar dcut2
+        )
+        {
+            using traits = box_traits<Box>;
+
+            distance_filter filter;
+            filter.center = center;
+            filter.period = traits::periods(box);
+            filter.inv_period = {
+                traits::x_periodic ? 1 / filter.period.x : 0,
+                traits::y_periodic ? 1 / filter.period.y : 0,
+                traits::z_periodic ? 1 / filter.period.z : 0
+            };
+            filter.dcut2 = dcut2;
+            return filter;
+        }
+
+        // Computes the shortest coordinate difference along an axis. This is
+        // the same computation as round_mod.
+        template<bool Periodic>
+        inline md::scalar wrap_difference(md::scalar d, md::scalar period, md::scalar inv_period)
+        {
+            return Periodic ? d - std::nearbyint(d * inv_period) * period : d;
+        }
+
+        // Computes the squared distance of a point from the center.
+        template<typename Box>
+        inline md::scalar squared_distance_from_center(
+            distance_filter const& filter, md::scalar x, md::scalar y, md::scalar z
+        )
+        {
+            using traits = box_traits<Box>;
+
+            auto const dx = wrap_difference<traits::x_periodic>(
+                x - filter.center.x, filter.period.x, filter.inv_period.x
+            );
+            auto const dy = wrap_difference<traits::y_periodic>(
+                y - filter.center.y, filter.period.y, filter.inv_period.y
+            );
+            auto const dz = wrap_difference<traits::z_periodic>(
+                z - filter.center.z, filter.period.z, filter.inv_period.z
+            );
+            return dx * dx + dy * dy + dz * dz;
+        }
+
+        // Scalar kernel. Tests points [begin, end) and appends the indices of
+        // the points within the cutoff distance to hits[hit_count...]. Returns
+        // the updated hit count.
+        template<typename Box>
+        inline md::index filter_within_scalar(
+            distance_filter const& filter,
+            md::scalar const* xs,
+            md::scalar const* ys,
+            md::scalar const* zs,
+            md::index begin,
+            md::index end,
+            uint32_t* hits,
+            md::index hit_count = 0
+        )
+        {
+            for (md::index i = begin; i < end; i++) {
+                auto const d2 = squared_distance_from_center<Box>(filter, xs[i], ys[i], zs[i]);
+
+                // Branchless compression.
+                hits[hit_count] = uint32_t(i);
+                hit_count += (d2 <= filter.dcut2) ? 1 : 0;
+            }
+
+            return hit_count;
+        }
+
+#if !defined(MD_NO_SIMD) && defined(__AVX512F__)
+
+        constexpr md::index simd_width = 8;
+
+        struct simd_ops
+        {
+            using type = __m512d;
+
+            static type broadcast(md::scalar x) { return _mm512_set1_pd(x); }
+            static type load(md::scalar const* p) { return _mm512_loadu_pd(p); }
+            static type add(type a, type b) { return _mm512_add_pd(a, b); }
+            static type sub(type a, type b) { return _mm512_sub_pd(a, b); }
+            static type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+
+            static type round(type a)
+            {
+                return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            }
+
+            static unsigned compare_le(type a, type b)
+            {
+                return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ);
+            }
+        };
+
+#elif !defined(MD_NO_SIMD) && defined(__AVX__)
+
+        constexpr md::index simd_width = 4;
+
+        struct simd_ops
+        {
+            using type = __m256d;
+
+            static type broadcast(md::scalar x) { return _mm256_set1_pd(x); }
+            static type load(md::scalar const* p) { return _mm256_loadu_pd(p); }
+            static type add(type a, type b) { return _mm256_add_pd(a, b); }
+            static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+            static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+
+            static type round(type a)
+            {
+                return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            }
+
+            static unsigned compare_le(type a, type b)
+            {
+                return unsigned(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ)));
+            }
+        };
+
+#elif !defined(MD_NO_SIMD) && defined(__SSE2__)
+
+        constexpr md::index simd_width = 2;
+
+        struct simd_ops
+        {
+            using type = __m128d;
+
+            static type broadcast(md::scalar x) { return _mm_set1_pd(x); }
+            static type load(md::scalar const* p) { return _mm_loadu_pd(p); }
+            static type add(type a, type b) { return _mm_add_pd(a, b); }
+            static type sub(type a, type b) { return _mm_sub_pd(a, b); }
+            static type mul(type a, type b) { return _mm_mul_pd(a, b); }
+
+            static type round(type a)
+            {
+# if defined(__SSE4_1__)
+                return _mm_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+# else
+                // Round-trip through int32 rounds to nearest in the default
+                // rounding mode. Image numbers beyond int32 are not supported.
+                return _mm_cvtepi32_pd(_mm_cvtpd_epi32(a));
+# endif
+            }
+
+            static unsigned compare_le(type a, type b)
+            {
+                return unsigned(_mm_movemask_pd(_mm_cmple_pd(a, b)));
+            }
+        };
+
+#else
+
+        constexpr md::index simd_width = 1;
+
+#endif
+
+#if !defined(MD_NO_SIMD) && (defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__))
+
+        // Computes the shortest coordinate differences along an axis.
+        template<bool Periodic>
+        inline simd_ops::type wrap_difference(
+            simd_ops::type d, simd_ops::type period, simd_ops::type inv_period
+        )
+        {
+            if (Periodic) {
+                auto const image = simd_ops::round(simd_ops::mul(d, inv_period));
+                return simd_ops::sub(d, simd_ops::mul(image, period));
+            }
+            return d;
+        }
+
+        // Vectorized kernel. Same as filter_within_scalar but tests
+        // simd_width points at once.
+        template<typename Box>
+        inline md::index filter_within_simd(
+            distance_filter const& filter,
+            md::scalar const* xs,
+            md::scalar const* ys,
+            md::scalar const* zs,
+            md::index begin,
+            md::index end,
+            uint32_t* hits,
+            md::index hit_count = 0
+        )
+        {
+            using traits = box_traits<Box>;
+            using ops = simd_ops;
+
+            auto const cx = ops::broadcast(filter.center.x);
+            auto const cy = ops::broadcast(filter.center.y);
+            auto const cz = ops::broadcast(filter.center.z);
+            auto const px = ops::broadcast(filter.period.x);
+            auto const py = ops::broadcast(filter.period.y);
+            auto const pz = ops::broadcast(filter.period.z);
+            auto const ix = ops::broadcast(filter.inv_period.x);
+            auto const iy = ops::broadcast(filter.inv_period.y);
+            auto const iz = ops::broadcast(filter.inv_period.z);
+            auto const dcut2 = ops::broadcast(filter.dcut2);
+
+            md::index i = begin;
+
+            for (; i + simd_width <= end; i += simd_width) {
+                auto const dx = wrap_difference<traits::x_periodic>(
+                    ops::sub(ops::load(xs + i), cx), px, ix
+                );
+                auto const dy = wrap_difference<traits::y_periodic>(
+                    ops::sub(ops::load(ys + i), cy), py, iy
+                );
+                auto const dz = wrap_difference<traits::z_periodic>(
+                    ops::sub(ops::load(zs + i), cz), pz, iz
+                );
+                auto const d2 = ops::add(
+                    ops::add(ops::mul(dx, dx), ops::mul(dy, dy)), ops::mul(dz, dz)
+                );
+                auto const mask = ops::compare_le(d2, dcut2);
+
+                // Branchless compression. hit_count never exceeds i + lane,
+                // so this never writes past the tested range.
+                for (unsigned lane = 0; lane < simd_width; lane++) {
+                    hits[hit_count] = uint32_t(i + lane);
+                    hit_count += (mask >> lane) & 1;
+                }
+            }
+
+            return filter_within_scalar<Box>(filter, xs, ys, zs, i, end, hits, hit_count);
+        }
+
+        // Tests points [begin, end) against filter and stores the indices of
+        // the points within the cutoff distance to hits. Returns the number of
+        // hits. hits must have room for (end - begin) indices.
+        template<typename Box>
+        inline md::index filter_within(
+            distance_filter const& filter,
+            md::scalar const* xs,
+            md::scalar const* ys,
+            md::scalar const* zs,
+            md::index begin,
+            md::index end,
+            uint32_t* hits
+        )
+        {
+            return filter_within_simd<Box>(filter, xs, ys, zs, begin, end, hits);
+        }
+
+#else
+
+        template<typename Box>
+        inline md::index filter_within(
+            distance_filter const& filter,
+            md::scalar const* xs,
+            md::scalar const* ys,
+            md::scalar const* zs,
+            md::index begin,
+            md::index end,
+            uint32_t* hits
+        )
+        {
+            return filter_within_scalar<Box>(filter, xs, ys, zs, begin, end, hits);
+        }
+
+#endif
+    }
+}
+
+#endif
@@ -8,8 +8,10 @@
 // This module provides mathematical functions used in neighbor search
 // implementations.
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <vector>
 
 #include "../../basic_types.hpp"
 
@@ -85,6 +87,71 @@ namespace md
             auto const index = trunc_uint(image * (1 / bins.step));
             return index < bins.count ? index : bins.count - 1;
         }
+
+        // A bin_merge groups runs of consecutive uniform bins into coarser
+        // bins. bins[i] is the coarse bin containing the uniform bin i. Empty
+        // bins means that the uniform bins are used as they are.
+        struct bin_merge
+        {
+            uint32_t count = 0;
+            std::vector<uint32_t> bins;
+        };
+
+        // Creates a bin_merge that keeps given uniform bins as they are.
+        inline bin_merge identity_merge(bin_layout const& bins)
+        {
+            bin_merge merge;
+            merge.count = bins.count;
+            return merge;
+        }
+
+        // Computes the index of the coarse bin containing the uniform bin.
+        inline uint32_t merged_bin(bin_merge const& merge, uint32_t bin)
+        {
+            return merge.bins.empty() ? bin : merge.bins[bin];
+        }
+
+        // Merges uniform bins so that bin edges roughly follow the density of
+        // the coordinates: Each uniform bin holding at least min_occupancy
+        // points stays as is, and runs of sparser bins are merged until the
+        // run holds min_occupancy points. A run cut short by a dense bin or
+        // the end becomes a coarse bin on its own, so no merged bin holds
+        // more than 2 * min_occupancy points.
+        inline bin_merge merge_sparse_bins(
+            std::vector<md::index> const& occupancy, md::scalar min_occupancy
+        )
+        {
+            bin_merge merge;
+            merge.bins.resize(occupancy.size());
+
+            md::scalar run = 0;
+            bool open = false;
+
+            for (md::index i = 0; i < occupancy.size(); i++) {
+                auto const occ = md::scalar(occupancy[i]);
+
+                if (open && occ >= min_occupancy) {
+                    merge.count++;
+                    run = 0;
+                }
+
+                merge.bins[i] = merge.count;
+                run += occ;
+                open = true;
+
+                if (run >= min_occupancy) {
+                    merge.count++;
+                    run = 0;
+                    open = false;
+                }
+            }
+
+            if (open) {
+                merge.count++;
+            }
+
+            return merge;
+        }
     }
 }
 
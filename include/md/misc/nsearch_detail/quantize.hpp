@@ -0,0 +1,383 @@
+// Copyright snsinfu 2019.
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef MD_MISC_NSEARCH_DETAIL_QUANTIZE_HPP
+#define MD_MISC_NSEARCH_DETAIL_QUANTIZE_HPP
+
+// This module implements 32-bit fixed-point encoding of coordinates used by
+// the compact member storage of neighbor_searcher, and a cutoff distance test
+// on the encoded coordinates.
+//
+// A periodic axis maps one period to 2^32 units, so that wraparound of the
+// unsigned difference of two encoded values gives the minimum image for free.
+// A non-periodic axis maps a frame enclosing the points to 2^32 units.
+//
+// The distance test is vectorized with the same instruction sets as the
+// kernel in distance_kernel.hpp.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "../../basic_types.hpp"
+#include "box_traits.hpp"
+#include "distance_kernel.hpp"
+#include "math.hpp"
+
+
+namespace md
+{
+    namespace nsearch_detail
+    {
+        using std::int32_t;
+        using std::uint32_t;
+        using std::uint64_t;
+
+        // Fixed-point encoding of one axis.
+        struct axis_quantizer
+        {
+            md::scalar lower = 0;
+            md::scalar upper = 0;
+            md::scalar step = 1;
+            md::scalar inv_step = 1;
+        };
+
+        // Number of units in a period or a frame.
+        constexpr md::scalar quantum_count = 4294967296.0;
+
+        // Creates an encoding of a periodic axis.
+        inline axis_quantizer make_periodic_quantizer(md::scalar period)
+        {
+            axis_quantizer axis;
+            axis.lower = 0;
+            axis.upper = period;
+            axis.step = period / quantum_count;
+            axis.inv_step = quantum_count / period;
+            return axis;
+        }
+
+        // Creates an encoding of a non-periodic axis that covers the range
+        // [lower, upper].
+        inline axis_quantizer make_open_quantizer(md::scalar lower, md::scalar upper)
+        {
+            // Use slightly fewer units than available so that rounding never
+            // overflows.
+            auto const span = std::max(upper - lower, md::scalar(1e-300));
+
+            axis_quantizer axis;
+            axis.lower = lower;
+            axis.upper = upper;
+            axis.step = span / (quantum_count - 2);
+            axis.inv_step = (quantum_count - 2) / span;
+            return axis;
+        }
+
+        // Encodes a coordinate value.
+        template<bool Periodic>
+        inline uint32_t quantize(axis_quantizer const& axis, md::scalar x)
+        {
+            if (Periodic) {
+                x = nsearch_detail::floor_mod(x, axis.upper);
+            } else {
+                x -= axis.lower;
+            }
+            // Periodic x may round up to a full period, which wraps to zero.
+            return uint32_t(uint64_t(std::nearbyint(x * axis.inv_step)));
+        }
+
+        // Computes the shortest difference of encoded values in units.
+        template<bool Periodic>
+        inline md::scalar quantized_difference(uint32_t a, uint32_t b)
+        {
+            if (Periodic) {
+                return md::scalar(int32_t(a - b));
+            }
+            return md::scalar(a) - md::scalar(b);
+        }
+
+        // quantizer encodes points into x/y/z fixed-point values.
+        template<typename Box>
+        struct quantizer
+        {
+            using traits = box_traits<Box>;
+
+            axis_quantizer x;
+            axis_quantizer y;
+            axis_quantizer z;
+
+            quantizer() = default;
+
+            // Creates a quantizer for points in a box. Frames of non-periodic
+            // axes enclose the bounding box of the points with given margin
+            // plus a quarter of the extent, so that the points can move a
+            // while without leaving the frames.
+            quantizer(Box const& box, md::array_view<md::point const> points, md::scalar margin)
+            {
+                md::point lower;
+                md::point upper;
+
+                if (!points.empty()) {
+                    lower = upper = points[0];
+                }
+                for (auto const pt : points) {
+                    lower.x = std::min(lower.x, pt.x);
+                    lower.y = std::min(lower.y, pt.y);
+                    lower.z = std::min(lower.z, pt.z);
+                    upper.x = std::max(upper.x, pt.x);
+                    upper.y = std::max(upper.y, pt.y);
+                    upper.z = std::max(upper.z, pt.z);
+                }
+
+                auto const frame_margin = 0.25 * (upper - lower) + md::vector{margin, margin, margin};
+                lower -= frame_margin;
+                upper += frame_margin;
+
+                auto const periods = traits::periods(box);
+                x = traits::x_periodic ? make_periodic_quantizer(periods.x) : make_open_quantizer(lower.x, upper.x);
+                y = traits::y_periodic ? make_periodic_quantizer(periods.y) : make_open_quantizer(lower.y, upper.y);
+                z = traits::z_periodic ? make_periodic_quantizer(periods.z) : make_open_quantizer(lower.z, upper.z);
+            }
+
+            // Returns true if the point can be encoded.
+            bool contains(md::point pt) const
+            {
+                return (traits::x_periodic || (pt.x >= x.lower && pt.x <= x.upper))
+                    && (traits::y_periodic || (pt.y >= y.lower && pt.y <= y.upper))
+                    && (traits::z_periodic || (pt.z >= z.lower && pt.z <= z.upper));
+            }
+
+            void encode(md::point pt, uint32_t& qx, uint32_t& qy, uint32_t& qz) const
+            {
+                qx = quantize<traits::x_periodic>(x, pt.x);
+                qy = quantize<traits::y_periodic>(y, pt.y);
+                qz = quantize<traits::z_periodic>(z, pt.z);
+            }
+
+            // Returns an upper bound of the error of the distance between two
+            // encoded points. Each encoded value is off by at most half a
+            // unit plus floating-point error, so a unit per point suffices.
+            md::scalar distance_error() const
+            {
+                auto const error = 2 * md::vector{x.step, y.step, z.step};
+                return error.norm();
+            }
+        };
+
+        // quantized_filter holds the parameters of a cutoff distance test on
+        // encoded points. Points within `inner` distance are surely within
+        // the cutoff, and points beyond `outer` distance are surely not.
+        struct quantized_filter
+        {
+            uint32_t center_x;
+            uint32_t center_y;
+            uint32_t center_z;
+            md::vector step;
+            md::scalar inner2;
+            md::scalar outer2;
+        };
+
+        // Creates a quantized_filter for squared cutoff distance dcut2.
+        template<typename Box>
+        quantized_filter make_quantized_filter(quantizer<Box> const& quant, md::scalar dcut2)
+        {
+            auto const dcut = std::sqrt(dcut2);
+            auto const error = quant.distance_error();
+            auto const inner = std::max(dcut - error, md::scalar(0));
+            auto const outer = dcut + error;
+
+            quantized_filter filter;
+            filter.center_x = 0;
+            filter.center_y = 0;
+            filter.center_z = 0;
+            filter.step = {quant.x.step, quant.y.step, quant.z.step};
+            filter.inner2 = inner * inner;
+            filter.outer2 = outer * outer;
+            return filter;
+        }
+
+        // Computes the squared distance of an encoded point from the center.
+        template<typename Box>
+        inline md::scalar quantized_squared_distance(
+            quantized_filter const& filter, uint32_t qx, uint32_t qy, uint32_t qz
+        )
+        {
+            using traits = box_traits<Box>;
+
+            auto const dx = quantized_difference<traits::x_periodic>(qx, filter.center_x) * filter.step.x;
+            auto const dy = quantized_difference<traits::y_periodic>(qy, filter.center_y) * filter.step.y;
+            auto const dz = quantized_difference<traits::z_periodic>(qz, filter.center_z) * filter.step.z;
+            return dx * dx + dy * dy + dz * dz;
+        }
+
+        // Flag set on a hit that is beyond the inner distance of the filter.
+        constexpr uint32_t uncertain_hit = 0x80000000u;
+
+        // Scalar kernel. Tests encoded points [begin, end) against the outer
+        // distance of the filter and appends the indices of the passing points
+        // to hits[hit_count...]. Hits beyond the inner distance are flagged
+        // with uncertain_hit. Returns the updated hit count.
+        template<typename Box>
+        inline md::index filter_within_quantized_scalar(
+            quantized_filter const& filter,
+            uint32_t const* qxs,
+            uint32_t const* qys,
+            uint32_t const* qzs,
+            md::index begin,
+            md::index end,
+            uint32_t* hits,
+            md::index hit_count = 0
+        )
+        {
+            for (md::index i = begin; i < end; i++) {
+                auto const d2 = quantized_squared_distance<Box>(filter, qxs[i], qys[i], qzs[i]);
+
+                // Branchless compression.
+                hits[hit_count] = uint32_t(i) | (d2 <= filter.inner2 ? 0 : uncertain_hit);
+                hit_count += (d2 <= filter.outer2) ? 1 : 0;
+            }
+
+            return hit_count;
+        }
+
+#if !defined(MD_NO_SIMD) && (defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__))
+
+        // Integer operations on simd_width lanes of 32-bit values.
+        struct quantized_simd_ops
+        {
+#if defined(__AVX512F__)
+            using type = __m256i;
+
+            static type load(uint32_t const* p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p)); }
+            static type broadcast(uint32_t x) { return _mm256_set1_epi32(int(x)); }
+            static type sub(type a, type b) { return _mm256_sub_epi32(a, b); }
+            static type bitwise_xor(type a, type b) { return _mm256_xor_si256(a, b); }
+            static simd_ops::type to_scalar(type a) { return _mm512_cvtepi32_pd(a); }
+#elif defined(__AVX__)
+            using type = __m128i;
+
+            static type load(uint32_t const* p) { return _mm_loadu_si128(reinterpret_cast<__m128i const*>(p)); }
+            static type broadcast(uint32_t x) { return _mm_set1_epi32(int(x)); }
+            static type sub(type a, type b) { return _mm_sub_epi32(a, b); }
+            static type bitwise_xor(type a, type b) { return _mm_xor_si128(a, b); }
+            static simd_ops::type to_scalar(type a) { return _mm256_cvtepi32_pd(a); }
+#else
+            using type = __m128i;
+
+            static type load(uint32_t const* p) { return _mm_loadl_epi64(reinterpret_cast<__m128i const*>(p)); }
+            static type broadcast(uint32_t x) { return _mm_set1_epi32(int(x)); }
+            static type sub(type a, type b) { return _mm_sub_epi32(a, b); }
+            static type bitwise_xor(type a, type b) { return _mm_xor_si128(a, b); }
+            static simd_ops::type to_scalar(type a) { return _mm_cvtepi32_pd(a); }
+#endif
+        };
+
+        // Computes the shortest differences of encoded values in units.
+        // Non-periodic values are biased into the signed range so that they
+        // can be converted to floating-point with signed conversion.
+        template<bool Periodic>
+        inline simd_ops::type quantized_difference(
+            quantized_simd_ops::type values, quantized_simd_ops::type center
+        )
+        {
+            using iops = quantized_simd_ops;
+
+            if (Periodic) {
+                return iops::to_scalar(iops::sub(values, center));
+            }
+
+            auto const bias = iops::broadcast(0x80000000u);
+            return simd_ops::sub(
+                iops::to_scalar(iops::bitwise_xor(values, bias)),
+                iops::to_scalar(iops::bitwise_xor(center, bias))
+            );
+        }
+
+        // Vectorized kernel. Same as filter_within_quantized_scalar but tests
+        // simd_width points at once.
+        template<typename Box>
+        inline md::index filter_within_quantized_simd(
+            quantized_filter const& filter,
+            uint32_t const* qxs,
+            uint32_t const* qys,
+            uint32_t const* qzs,
+            md::index begin,
+            md::index end,
+            uint32_t* hits
+        )
+        {
+            using traits = box_traits<Box>;
+            using ops = simd_ops;
+            using iops = quantized_simd_ops;
+
+            auto const cx = iops::broadcast(filter.center_x);
+            auto const cy = iops::broadcast(filter.center_y);
+            auto const cz = iops::broadcast(filter.center_z);
+            auto const sx = ops::broadcast(filter.step.x);
+            auto const sy = ops::broadcast(filter.step.y);
+            auto const sz = ops::broadcast(filter.step.z);
+            auto const inner2 = ops::broadcast(filter.inner2);
+            auto const outer2 = ops::broadcast(filter.outer2);
+
+            md::index i = begin;
+            md::index hit_count = 0;
+
+            for (; i + simd_width <= end; i += simd_width) {
+                auto const dx = ops::mul(quantized_difference<traits::x_periodic>(iops::load(qxs + i), cx), sx);
+                auto const dy = ops::mul(quantized_difference<traits::y_periodic>(iops::load(qys + i), cy), sy);
+                auto const dz = ops::mul(quantized_difference<traits::z_periodic>(iops::load(qzs + i), cz), sz);
+                auto const d2 = ops::add(
+                    ops::add(ops::mul(dx, dx), ops::mul(dy, dy)), ops::mul(dz, dz)
+                );
+                auto const mask = ops::compare_le(d2, outer2);
+                auto const uncertain = ~ops::compare_le(d2, inner2);
+
+                for (unsigned lane = 0; lane < simd_width; lane++) {
+                    hits[hit_count] = uint32_t(i + lane) | ((uncertain >> lane & 1) << 31);
+                    hit_count += (mask >> lane) & 1;
+                }
+            }
+
+            return filter_within_quantized_scalar<Box>(filter, qxs, qys, qzs, i, end, hits, hit_count);
+        }
+
+        // Tests encoded points [begin, end) against the outer distance of the
+        // filter and stores the indices of the passing points to hits.
+        // Returns the number of hits. The caller needs to check the hits
+        // flagged with uncertain_hit with exact coordinates. end must not
+        // exceed 2^31.
+        template<typename Box>
+        inline md::index filter_within_quantized(
+            quantized_filter const& filter,
+            uint32_t const* qxs,
+            uint32_t const* qys,
+            uint32_t const* qzs,
+            md::index begin,
+            md::index end,
+            uint32_t* hits
+        )
+        {
+            return filter_within_quantized_simd<Box>(filter, qxs, qys, qzs, begin, end, hits);
+        }
+
+#else
+
+        template<typename Box>
+        inline md::index filter_within_quantized(
+            quantized_filter const& filter,
+            uint32_t const* qxs,
+            uint32_t const* qys,
+            uint32_t const* qzs,
+            md::index begin,
+            md::index end,
+            uint32_t* hits
+        )
+        {
+            return filter_within_quantized_scalar<Box>(filter, qxs, qys, qzs, begin, end, hits);
+        }
+
+#endif
+    }
+}
+
+#endif
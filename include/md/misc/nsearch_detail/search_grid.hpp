@@ -8,13 +8,20 @@
 // This module defines spatial_bucket, and search_grid for standard boxes.
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <utility>
 #include <vector>
 
 #include "../../basic_types.hpp"
 #include "../box.hpp"
 #include "../linear_hash.hpp"
+#include "../neighbor_search_options.hpp"
+#include "box_traits.hpp"
+#include "cell_table.hpp"
 #include "math.hpp"
 
 
@@ -23,6 +30,7 @@ namespace md
     namespace nsearch_detail
     {
         using std::uint32_t;
+        using std::uint64_t;
         using std::size_t;
 
         // Sort and remove duplicates in a container.
@@ -33,114 +41,472 @@ namespace md
             cont.erase(std::unique(cont.begin(), cont.end()), cont.end());
         }
 
-        // Bucket for spatial hash table.
-        struct spatial_bucket
+        // Offset from a cell to another cell in units of cells.
+        struct cell_offset
         {
-            struct member
-            {
-                md::index index;
-                md::point point;
+            std::int32_t dx;
+            std::int32_t dy;
+            std::int32_t dz;
+        };
+
+        // Computes the stencil of a grid whose cells are at least spacing/n
+        // wide: the offsets of the cells that may contain a point closer than
+        // spacing to a point in the center cell. n = 1 gives the 27 cells
+        // around the center. Finer cells hug the cutoff sphere more tightly:
+        // The stencil covers 27, 15.6 and 11.5 times the cutoff cubed for
+        // n = 1, 2 and 3, respectively.
+        inline std::vector<cell_offset> make_stencil(uint32_t n)
+        {
+            // Points in two cells d apart along an axis are more than
+            // (|d| - 1) cells apart along the axis. Keep the cell if the
+            // lower bound of the distance is less than n cells.
+            auto const gap = [](std::int32_t d) {
+                return d == 0 ? 0 : std::abs(d) - 1;
             };
+            auto const reach = std::int32_t(n);
 
-            // Points in the bucket.
-            std::vector<member> members;
+            std::vector<cell_offset> stencil;
 
-            // Indices of the buckets spatially adjoining to this bucket.
-            std::vector<md::index> complete_neighbors;
+            for (auto dz = -reach; dz <= reach; dz++) {
+                for (auto dy = -reach; dy <= reach; dy++) {
+                    for (auto dx = -reach; dx <= reach; dx++) {
+                        auto const gap2 = gap(dx) * gap(dx) + gap(dy) * gap(dy) + gap(dz) * gap(dz);
+                        if (gap2 < reach * reach) {
+                            stencil.push_back({dx, dy, dz});
+                        }
+                    }
+                }
+            }
 
-            // Subset of complete_neighbors where bidirectional links in the
-            // adjoining graph are reduced to a unidirectional one.
-            std::vector<md::index> directed_neighbors;
-        };
+            return stencil;
+        }
 
         // Helper class for generating x/y/z_bins for given box and spacing.
         template<typename Box>
         struct basic_binner;
 
         // search_grid abstracts away how points should be grouped into spatial
-        // neighbors in given box.
+        // neighbors in given box. Points are grouped into buckets indexed from
+        // 0 to bucket_count() - 1. The points themselves are stored in arrays
+        // owned by neighbor_searcher.
+        //
+        // Adjacency of buckets is not stored but computed on the fly from the
+        // bucket index: for_each_directed_neighbor enumerates the adjacency
+        // graph with each bidirectional link reduced to a unidirectional one,
+        // and for_each_adjacent_bucket enumerates all buckets adjoining to a
+        // point.
         template<typename Box>
         struct search_grid;
 
         // Generic implementation of search_grid for bin-based construction.
+        //
+        // Each axis is split into uniform bins, x/y/z_bins. With the
+        // adaptive_bins option, runs of sparse uniform bins along periodic
+        // axes are merged into coarser bins (x/y/z_merge_) fitted to the
+        // points. Coarse bins are no narrower than uniform bins, so the
+        // stencil reaching subdivision bins away still covers the cutoff
+        // distance.
         template<typename Box>
         struct binned_search_grid
         {
-            nsearch_detail::bin_layout  x_bins;
-            nsearch_detail::bin_layout  y_bins;
-            nsearch_detail::bin_layout  z_bins;
-            std::vector<spatial_bucket> buckets;
+            nsearch_detail::bin_layout x_bins;
+            nsearch_detail::bin_layout y_bins;
+            nsearch_detail::bin_layout z_bins;
 
-            binned_search_grid(Box box, md::scalar spacing)
+            // Creates a grid for finding points closer than spacing. The bins
+            // are at least spacing/subdivision wide.
+            binned_search_grid(
+                Box box, md::scalar spacing, md::neighbor_search_options const& options = {}
+            )
+                : bin_spacing_{spacing / std::max(options.subdivision, uint32_t(1))}
+                , stencil_{make_stencil(std::max(options.subdivision, uint32_t(1)))}
+                , stencil_width_{2 * std::max(options.subdivision, uint32_t(1)) + 1}
+                , adaptive_{options.adaptive_bins}
             {
-                init_bins(box, spacing);
-                init_buckets();
+                init_bins(box);
+            }
+
+            size_t bucket_count() const
+            {
+                return size_t(x_merge_.count) * y_merge_.count * z_merge_.count;
             }
 
             inline size_t locate_bucket(md::point pt) const
             {
-                auto const x = nsearch_detail::locate_bin(x_bins, pt.x);
-                auto const y = nsearch_detail::locate_bin(y_bins, pt.y);
-                auto const z = nsearch_detail::locate_bin(z_bins, pt.z);
-                return do_locate_bucket(x, y, z);
+                return do_locate_bucket(locate_x(pt.x), locate_y(pt.y), locate_z(pt.z));
+            }
+
+            // Calls fn(bucket_index) for each bucket that may contain points
+            // within the spacing from pt.
+            template<typename Fn>
+            void for_each_adjacent_bucket(md::point pt, Fn fn) const
+            {
+                for_each_stencil_bucket(locate_bucket(pt), fn);
+            }
+
+            // Calls fn(neighbor_index) for each bucket adjoining to the bucket
+            // with index not greater than bucket_index.
+            template<typename Fn>
+            void for_each_directed_neighbor(size_t bucket_index, Fn fn) const
+            {
+                for_each_stencil_bucket(bucket_index, [&](size_t neighbor_index) {
+                    if (neighbor_index <= bucket_index) {
+                        fn(neighbor_index);
+                    }
+                });
+            }
+
+            // Adapts the grid to given point cloud. Returns true if the bucket
+            // layout has changed. Uniform bins are defined by the box, so this
+            // does nothing unless adaptive_bins is enabled. The coarse bins
+            // are kept until points crowd into a merged bin or the bins could
+            // be merged much further, so that fluctuations of the points do
+            // not trigger rebuilds.
+            bool fit(md::array_view<md::point const> points)
+            {
+                using traits = box_traits<Box>;
+
+                if (!adaptive_ || points.empty()) {
+                    return false;
+                }
+
+                x_occupancy_.assign(x_bins.count, 0);
+                y_occupancy_.assign(y_bins.count, 0);
+                z_occupancy_.assign(z_bins.count, 0);
+
+                for (auto const pt : points) {
+                    x_occupancy_[nsearch_detail::locate_bin(x_bins, pt.x)]++;
+                    y_occupancy_[nsearch_detail::locate_bin(y_bins, pt.y)]++;
+                    z_occupancy_[nsearch_detail::locate_bin(z_bins, pt.z)]++;
+                }
+
+                auto const x_changed = traits::x_periodic && refit_bins(x_merge_, x_occupancy_, points.size());
+                auto const y_changed = traits::y_periodic && refit_bins(y_merge_, y_occupancy_, points.size());
+                auto const z_changed = traits::z_periodic && refit_bins(z_merge_, z_occupancy_, points.size());
+
+                if (x_changed || y_changed || z_changed) {
+                    update_stencil_wraps();
+                    return true;
+                }
+                return false;
+            }
+
+            // Adapts the grid to a changed box in place if possible. Returns
+            // false and leaves the grid unchanged if the box needs a new grid.
+            //
+            // Buckets are laid out layer by layer along z, so changing only
+            // the number of z bins appends or drops layers at the top edge and
+            // keeps the indices of the other buckets. Only the points in the
+            // layers added or dropped, or wrapping around z, change bucket.
+            // This is the case of xy_periodic_box whose z_span varies. Merged
+            // z bins are kept and the layers added at the top edge are not
+            // merged; the next fit merges them if they are sparse.
+            bool reshape(Box box)
+            {
+                basic_binner<Box> binner{box, bin_spacing_};
+
+                if (!same_bins(binner.x_bins, x_bins) ||
+                    !same_bins(binner.y_bins, y_bins) ||
+                    binner.z_bins.step != z_bins.step) {
+                    return false;
+                }
+
+                z_bins = binner.z_bins;
+                resize_merge(z_merge_, z_bins.count);
+                update_stencil_wraps();
+                return true;
+            }
+
+            // Every bucket is a single cell, so shell enumeration below never
+            // visits the same bucket twice.
+            static constexpr bool unique_shell_buckets = true;
+
+            // Returns the distance w such that all points closer than r*w to a
+            // point are in the shells 0, ..., r around the point.
+            md::scalar shell_width() const
+            {
+                return std::min({x_bins.step, y_bins.step, z_bins.step});
+            }
+
+            // Returns true if the shells 0, ..., r cover the whole grid.
+            bool covers_all(uint32_t r) const
+            {
+                return x_merge_.count <= 2 * r + 1
+                    && y_merge_.count <= 2 * r + 1
+                    && z_merge_.count <= 2 * r + 1;
+            }
+
+            // Calls fn(bucket_index) for each bucket in the shell of cells at
+            // Chebyshev distance r from the cell containing pt.
+            template<typename Fn>
+            void for_each_shell_bucket(md::point pt, uint32_t r, Fn fn) const
+            {
+                auto const x = locate_x(pt.x);
+                auto const y = locate_y(pt.y);
+                auto const z = locate_z(pt.z);
+
+                auto const x_offsets = shell_offsets(x_merge_.count, r);
+                auto const y_offsets = shell_offsets(y_merge_.count, r);
+                auto const z_offsets = shell_offsets(z_merge_.count, r);
+
+                for (auto const& dz : z_offsets) {
+                    for (auto const& dy : y_offsets) {
+                        for (auto const& dx : x_offsets) {
+                            if (std::max({dx.second, dy.second, dz.second}) != r) {
+                                continue;
+                            }
+                            fn(do_locate_bucket(
+                                nsearch_detail::add_mod(x, dx.first, x_merge_.count),
+                                nsearch_detail::add_mod(y, dy.first, y_merge_.count),
+                                nsearch_detail::add_mod(z, dz.first, z_merge_.count)
+                            ));
+                        }
+                    }
+                }
+            }
+
+            // Calls fn(bucket_index) for each distinct bucket that may contain
+            // points in the axis-aligned box [lower, upper]. Coordinates wrap
+            // around the bins, so the box may straddle the edge of the bins.
+            template<typename Fn>
+            void for_each_region_bucket(md::point lower, md::point upper, Fn fn) const
+            {
+                auto const xs = region_bins(x_bins, x_merge_, lower.x, upper.x);
+                auto const ys = region_bins(y_bins, y_merge_, lower.y, upper.y);
+                auto const zs = region_bins(z_bins, z_merge_, lower.z, upper.z);
+
+                for (auto const z : zs) {
+                    for (auto const y : ys) {
+                        for (auto const x : xs) {
+                            fn(do_locate_bucket(x, y, z));
+                        }
+                    }
+                }
             }
 
         private:
-            void init_bins(Box box, md::scalar spacing)
+            // Returns the distinct coarse bins overlapping [lower, upper]. The
+            // bins of the ends are located the same way as points, so points
+            // on the ends are never missed due to rounding.
+            static std::vector<uint32_t> region_bins(
+                bin_layout const& bins, bin_merge const& merge, md::scalar lower, md::scalar upper
+            )
+            {
+                std::vector<uint32_t> result;
+
+                if (upper - lower + 2 * bins.step >= bins.step * md::scalar(bins.count)) {
+                    for (uint32_t bin = 0; bin < merge.count; bin++) {
+                        result.push_back(bin);
+                    }
+                    return result;
+                }
+
+                auto const last = nsearch_detail::locate_bin(bins, upper);
+                for (auto cell = nsearch_detail::locate_bin(bins, lower); ; ) {
+                    result.push_back(nsearch_detail::merged_bin(merge, cell));
+                    if (cell == last) {
+                        break;
+                    }
+                    cell = nsearch_detail::add_mod(cell, 1, bins.count);
+                }
+                sort_unique(result);
+
+                return result;
+            }
+
+            // Returns the distinct bin offsets modulo count within distance r,
+            // paired with the circular distance of the offset.
+            static std::vector<std::pair<uint32_t, uint32_t>> shell_offsets(
+                uint32_t count, uint32_t r
+            )
+            {
+                std::vector<std::pair<uint32_t, uint32_t>> offsets;
+
+                if (count <= 2 * r + 1) {
+                    for (uint32_t d = 0; d < count; d++) {
+                        offsets.emplace_back(d, std::min(d, count - d));
+                    }
+                } else {
+                    offsets.emplace_back(0, 0);
+                    for (uint32_t d = 1; d <= r; d++) {
+                        offsets.emplace_back(d, d);
+                        offsets.emplace_back(count - d, d);
+                    }
+                }
+
+                return offsets;
+            }
+
+            void init_bins(Box box)
             {
-                basic_binner<Box> binner{box, spacing};
+                basic_binner<Box> binner{box, bin_spacing_};
                 x_bins = binner.x_bins;
                 y_bins = binner.y_bins;
                 z_bins = binner.z_bins;
+                x_merge_ = identity_merge(x_bins);
+                y_merge_ = identity_merge(y_bins);
+                z_merge_ = identity_merge(z_bins);
+                update_stencil_wraps();
+            }
+
+            // Changes the number of uniform bins of a merge. Bins are appended
+            // as unmerged coarse bins or dropped from the end.
+            static void resize_merge(bin_merge& merge, uint32_t count)
+            {
+                if (merge.bins.empty()) {
+                    merge.count = count;
+                    return;
+                }
+
+                if (count < merge.bins.size()) {
+                    merge.bins.resize(count);
+                    merge.count = merge.bins.back() + 1;
+                }
+                while (merge.bins.size() < count) {
+                    merge.bins.push_back(merge.count++);
+                }
             }
 
-            void init_buckets()
+            // Merges sparse bins of an axis given the occupancy of the uniform
+            // bins. Returns true if the merge has been replaced.
+            static bool refit_bins(
+                bin_merge& merge, std::vector<md::index> const& occupancy, md::index point_count
+            )
             {
-                buckets.clear();
-                buckets.resize(x_bins.count * y_bins.count * z_bins.count);
+                // Bins holding less than half the mean occupancy get merged.
+                auto const mean = md::scalar(point_count) / md::scalar(occupancy.size());
+                auto const min_occupancy = std::max(mean / 2, md::scalar(1));
+
+                auto fitted = nsearch_detail::merge_sparse_bins(occupancy, min_occupancy);
+
+                // A merged bin holds at most 2 * min_occupancy points when
+                // fitted. It is crowded if the density has doubled since then.
+                bool crowded = false;
 
-                for (uint32_t z = 0; z < z_bins.count; z++) {
-                    for (uint32_t y = 0; y < y_bins.count; y++) {
-                        for (uint32_t x = 0; x < x_bins.count; x++) {
-                            init_bucket_adjacents(x, y, z);
+                if (!merge.bins.empty()) {
+                    std::vector<md::index> totals(merge.count);
+                    std::vector<md::index> widths(merge.count);
+
+                    for (md::index i = 0; i < occupancy.size(); i++) {
+                        totals[merge.bins[i]] += occupancy[i];
+                        widths[merge.bins[i]]++;
+                    }
+
+                    for (md::index bin = 0; bin < merge.count; bin++) {
+                        if (widths[bin] > 1 && md::scalar(totals[bin]) > 4 * min_occupancy) {
+                            crowded = true;
                         }
                     }
                 }
+
+                if (!crowded && fitted.count * 4 >= merge.count * 3) {
+                    return false;
+                }
+
+                if (fitted.count == occupancy.size()) {
+                    fitted.bins.clear();
+                }
+
+                if (fitted.count == merge.count && fitted.bins == merge.bins) {
+                    return false;
+                }
+
+                merge = std::move(fitted);
+                return true;
+            }
+
+            // The stencil wraps onto itself along an axis with fewer bins than
+            // the stencil is wide, so the same bucket may come up more than
+            // once.
+            void update_stencil_wraps()
+            {
+                stencil_wraps_ =
+                    x_merge_.count < stencil_width_ ||
+                    y_merge_.count < stencil_width_ ||
+                    z_merge_.count < stencil_width_;
             }
 
-            // Initializes adjacent links of a bucket that covers (x,y,z) bin.
-            void init_bucket_adjacents(uint32_t x, uint32_t y, uint32_t z)
+            static bool same_bins(bin_layout const& bins1, bin_layout const& bins2)
             {
-                auto const bucket_index = do_locate_bucket(x, y, z);
-                auto& bucket = buckets[bucket_index];
+                return bins1.count == bins2.count && bins1.step == bins2.step;
+            }
 
-                uint32_t const dx_values[] = {0, 1, x_bins.count - 1};
-                uint32_t const dy_values[] = {0, 1, y_bins.count - 1};
-                uint32_t const dz_values[] = {0, 1, z_bins.count - 1};
+            // Calls fn(neighbor_index) for each distinct bucket covered by the
+            // stencil centered at given bucket.
+            template<typename Fn>
+            void for_each_stencil_bucket(size_t bucket_index, Fn fn) const
+            {
+                auto const x = uint32_t(bucket_index % x_merge_.count);
+                auto const y = uint32_t(bucket_index / x_merge_.count % y_merge_.count);
+                auto const z = uint32_t(bucket_index / x_merge_.count / y_merge_.count);
 
-                for (auto const dz : dz_values) {
-                    for (auto const dy : dy_values) {
-                        for (auto const dx : dx_values) {
-                            auto const adj_x = nsearch_detail::add_mod(x, dx, x_bins.count);
-                            auto const adj_y = nsearch_detail::add_mod(y, dy, y_bins.count);
-                            auto const adj_z = nsearch_detail::add_mod(z, dz, z_bins.count);
-                            auto const adj_index = do_locate_bucket(adj_x, adj_y, adj_z);
-                            if (adj_index <= bucket_index) {
-                                bucket.directed_neighbors.push_back(adj_index);
-                            }
-                            bucket.complete_neighbors.push_back(adj_index);
-                        }
+                auto adjacent = [&](cell_offset const& offset) {
+                    return do_locate_bucket(
+                        wrap_offset(x, offset.dx, x_merge_.count),
+                        wrap_offset(y, offset.dy, y_merge_.count),
+                        wrap_offset(z, offset.dz, z_merge_.count)
+                    );
+                };
+
+                if (!stencil_wraps_) {
+                    for (auto const& offset : stencil_) {
+                        fn(adjacent(offset));
                     }
+                    return;
+                }
+
+                std::vector<size_t> neighbors;
+                for (auto const& offset : stencil_) {
+                    neighbors.push_back(adjacent(offset));
                 }
+                sort_unique(neighbors);
+
+                for (auto const neighbor_index : neighbors) {
+                    fn(neighbor_index);
+                }
+            }
 
-                sort_unique(bucket.directed_neighbors);
-                sort_unique(bucket.complete_neighbors);
+            // Computes (bin + offset) mod count.
+            static uint32_t wrap_offset(uint32_t bin, std::int32_t offset, uint32_t count)
+            {
+                auto const residue = offset % std::int32_t(count);
+                auto const delta = uint32_t(residue < 0 ? residue + std::int32_t(count) : residue);
+                return nsearch_detail::add_mod(bin, delta, count);
             }
 
             size_t do_locate_bucket(uint32_t x, uint32_t y, uint32_t z) const
             {
-                return x + x_bins.count * (y + y_bins.count * z);
+                return x + x_merge_.count * (y + y_merge_.count * z);
+            }
+
+            // Computes the index of the coarse bin in which given coordinate
+            // value falls. Same for locate_y and locate_z.
+            inline uint32_t locate_x(md::scalar x) const
+            {
+                return nsearch_detail::merged_bin(x_merge_, nsearch_detail::locate_bin(x_bins, x));
+            }
+
+            inline uint32_t locate_y(md::scalar y) const
+            {
+                return nsearch_detail::merged_bin(y_merge_, nsearch_detail::locate_bin(y_bins, y));
+            }
+
+            inline uint32_t locate_z(md::scalar z) const
+            {
+                return nsearch_detail::merged_bin(z_merge_, nsearch_detail::locate_bin(z_bins, z));
             }
+
+            md::scalar bin_spacing_;
+            std::vector<cell_offset> stencil_;
+            uint32_t stencil_width_;
+            bool stencil_wraps_ = false;
+            bool adaptive_;
+            nsearch_detail::bin_merge x_merge_;
+            nsearch_detail::bin_merge y_merge_;
+            nsearch_detail::bin_merge z_merge_;
+            std::vector<md::index> x_occupancy_;
+            std::vector<md::index> y_occupancy_;
+            std::vector<md::index> z_occupancy_;
         };
 
         // Periodic box is easy. Just split each axis into uniform bins.
@@ -212,23 +578,522 @@ namespace md
             using binned_search_grid::binned_search_grid;
         };
 
+        // Generic box periodic along some axes. Periodic axes are split into
+        // uniform bins. Open axes are binned into wrapping layers like the z
+        // axis of xy_periodic_box, with the number of layers estimated from
+        // the span hints.
+        template<unsigned Mask>
+        struct basic_binner<md::axis_periodic_box<Mask>>
+        {
+            using box_type = md::axis_periodic_box<Mask>;
+
+            nsearch_detail::bin_layout x_bins;
+            nsearch_detail::bin_layout y_bins;
+            nsearch_detail::bin_layout z_bins;
+
+            basic_binner(box_type box, md::scalar spacing)
+            {
+                x_bins = define_axis_bins<box_type::x_periodic>(box.x_period, spacing);
+                y_bins = define_axis_bins<box_type::y_periodic>(box.y_period, spacing);
+                z_bins = define_axis_bins<box_type::z_periodic>(box.z_period, spacing);
+                estimate_open_bins(box, spacing);
+            }
+
+        private:
+            // Splits a periodic axis into uniform bins. An open axis gets a
+            // single bin for now.
+            template<bool Periodic>
+            static nsearch_detail::bin_layout define_axis_bins(md::scalar period, md::scalar spacing)
+            {
+                if (Periodic) {
+                    return nsearch_detail::define_bins(period, spacing);
+                }
+                nsearch_detail::bin_layout bins;
+                bins.step = spacing;
+                bins.count = 1;
+                return bins;
+            }
+
+            // Determines the number of layers along the open axes so that the
+            // resulting buckets do not get too sparse. Layers are distributed
+            // among open axes in proportion to the spans.
+            void estimate_open_bins(box_type box, md::scalar spacing)
+            {
+                // Too low bucket occupancy makes neighbor search inefficient.
+                // This is a heuristic minimum.
+                constexpr md::scalar min_bin_occupancy = 4.0;
+
+                constexpr int open_axes =
+                    (box_type::x_periodic ? 0 : 1) +
+                    (box_type::y_periodic ? 0 : 1) +
+                    (box_type::z_periodic ? 0 : 1);
+
+                if (open_axes == 0) {
+                    return;
+                }
+
+                auto const x_extent = box_type::x_periodic ? box.x_period : box.x_span;
+                auto const y_extent = box_type::y_periodic ? box.y_period : box.y_span;
+                auto const z_extent = box_type::z_periodic ? box.z_period : box.z_span;
+
+                const auto volume = x_extent * y_extent * z_extent;
+                const auto density = md::scalar(box.particle_count) / volume;
+                const auto bin_volume = x_bins.step * y_bins.step * z_bins.step;
+                const auto bin_occupancy = density * bin_volume;
+
+                const auto target_occupancy = std::max(bin_occupancy, min_bin_occupancy);
+                const auto bucket_count = md::scalar(box.particle_count) / target_occupancy;
+                const auto open_cells = bucket_count / (x_bins.count * y_bins.count * z_bins.count);
+
+                // Scale the number of spacing-wide layers along each open
+                // axis by the same factor to get open_cells in total.
+                auto const layers = [=](bool periodic, md::scalar span) {
+                    return periodic ? md::scalar(1) : std::max(span, spacing) / spacing;
+                };
+                auto const x_layers = layers(box_type::x_periodic, box.x_span);
+                auto const y_layers = layers(box_type::y_periodic, box.y_span);
+                auto const z_layers = layers(box_type::z_periodic, box.z_span);
+                auto const scale = std::pow(open_cells / (x_layers * y_layers * z_layers), 1.0 / open_axes);
+
+                auto const scaled_count = [=](md::scalar axis_layers) {
+                    auto const bin_count = axis_layers * scale;
+                    return nsearch_detail::round_uint(bin_count < 1 ? 1 : bin_count);
+                };
+                if (!box_type::x_periodic) {
+                    x_bins.count = scaled_count(x_layers);
+                }
+                if (!box_type::y_periodic) {
+                    y_bins.count = scaled_count(y_layers);
+                }
+                if (!box_type::z_periodic) {
+                    z_bins.count = scaled_count(z_layers);
+                }
+            }
+        };
+
+        template<unsigned Mask>
+        struct search_grid<md::axis_periodic_box<Mask>>
+            : binned_search_grid<md::axis_periodic_box<Mask>>
+        {
+            using binned_search_grid<md::axis_periodic_box<Mask>>::binned_search_grid;
+        };
+
         // search_grid implementation for open_box. Open system tends to be
-        // sparse, so we use hashing instead of binning to construct a grid.
+        // sparse, so by default we use hashing instead of binning to construct
+        // a grid. Hashing maps distant cells to the same bucket, though, which
+        // inflates candidate checks in a compact point cloud. So the grid
+        // switches to binning the bounding box of the point cloud when the
+        // bins would be well filled or the hash collides a lot. Subdivision
+        // applies only to the bins; hashed cells are always spacing wide.
+        //
+        // With open_grid_policy::exact_hash the grid instead keeps a bucket
+        // for each occupied cell in an exact hash table. Buckets of new cells
+        // are appended as points move into them, so bucket assignments of the
+        // existing points stay valid. The grid falls back to hashing if a
+        // point lies beyond the range of cell keys (2^20 cells from the
+        // origin along any axis).
         template<>
         struct search_grid<md::open_box>
         {
-            md::scalar                  spacing;
-            md::linear_hash             hash;
-            std::vector<spatial_bucket> buckets;
+            md::scalar      spacing;
+            md::linear_hash hash;
 
-            search_grid(md::open_box box, md::scalar spacing)
+            search_grid(
+                md::open_box box, md::scalar spacing, md::neighbor_search_options const& options = {}
+            )
                 : spacing{spacing}
+                , bin_step_{spacing / std::max(options.subdivision, uint32_t(1))}
+                , stencil_{make_stencil(std::max(options.subdivision, uint32_t(1)))}
+                , exact_{options.open_grid == md::open_grid_policy::exact_hash}
+            {
+                if (!exact_) {
+                    capacity_ = box.particle_count;
+                    init_hash(capacity_);
+                }
+            }
+
+            size_t bucket_count() const
             {
-                init_hash(box);
-                init_buckets();
+                if (exact_) {
+                    return cells_.size();
+                }
+                if (binned_) {
+                    return size_t(x_count_) * y_count_ * z_count_;
+                }
+                return hash.modulus;
             }
 
+            // Returns the index of the bucket containing pt. With exact
+            // hashing, returns bucket_count() if the cell of pt has no bucket.
             inline size_t locate_bucket(md::point pt) const
+            {
+                if (exact_) {
+                    auto const bucket_index = cells_.find(locate_cell_key(pt));
+                    return bucket_index == no_bucket ? cells_.size() : bucket_index;
+                }
+
+                if (binned_) {
+                    return locate_binned_bucket(pt);
+                }
+
+                uint32_t x, y, z;
+                locate_cell(pt, x, y, z);
+                return hash(x, y, z);
+            }
+
+            // Adapts the grid to a changed box. The exact hash does not
+            // depend on the box. The hash is sized for a particle capacity,
+            // which starts at the particle count hinted by the box. The hash
+            // is kept as long as the hinted count stays between capacity /
+            // shrink_threshold and capacity, so adding or removing a few
+            // particles costs nothing. Otherwise the capacity is reset to
+            // growth_factor times the count, and the next fit reports a
+            // layout change if points are hashed. The number of buckets thus
+            // stays within a constant factor of the ideal. Always returns
+            // true.
+            bool reshape(md::open_box box)
+            {
+                if (exact_) {
+                    return true;
+                }
+
+                auto const count = box.particle_count;
+                if (count <= capacity_ && count * shrink_threshold >= capacity_) {
+                    return true;
+                }
+
+                capacity_ = count * growth_factor;
+
+                auto const modulus = hash_modulus(capacity_);
+                if (modulus != hash.modulus) {
+                    init_hash(capacity_);
+                    relayout_ = !binned_;
+                }
+                return true;
+            }
+
+            // Adapts the grid to given point cloud. Returns true if the bucket
+            // layout has changed. The layout is kept as long as the point
+            // cloud stays roughly the same size.
+            bool fit(md::array_view<md::point const> points)
+            {
+                if (exact_) {
+                    bool purged = false;
+                    if (fit_cells(points, purged)) {
+                        return purged;
+                    }
+
+                    // Cells out of the key range would alias. Switch to
+                    // hashing, which needs a full relayout.
+                    exact_ = false;
+                    cells_.clear();
+                    capacity_ = points.size();
+                    init_hash(capacity_);
+                    relayout_ = true;
+                }
+
+                // The hash has been resized by reshape.
+                bool const relayout = relayout_;
+                relayout_ = false;
+
+                if (points.empty()) {
+                    return relayout;
+                }
+
+                md::point lower = points[0];
+                md::point upper = points[0];
+
+                for (auto const pt : points) {
+                    lower.x = std::min(lower.x, pt.x);
+                    lower.y = std::min(lower.y, pt.y);
+                    lower.z = std::min(lower.z, pt.z);
+                    upper.x = std::max(upper.x, pt.x);
+                    upper.y = std::max(upper.y, pt.y);
+                    upper.z = std::max(upper.z, pt.z);
+                }
+
+                // Points outside the bins are clamped to the nearest bin. This
+                // is correct but inefficient, so refit in that case.
+                auto const cells = count_cells(lower, upper, spacing);
+
+                if (binned_) {
+                    bool const inside =
+                        lower.x >= origin_.x && upper.x < origin_.x + bin_step_ * x_count_ &&
+                        lower.y >= origin_.y && upper.y < origin_.y + bin_step_ * y_count_ &&
+                        lower.z >= origin_.z && upper.z < origin_.z + bin_step_ * z_count_;
+                    auto const bin_cells = count_cells(lower, upper, bin_step_);
+                    if (inside && bin_cells * max_shrink >= md::scalar(bucket_count())) {
+                        return false;
+                    }
+                } else {
+                    if (cells * max_shrink >= evaluated_cells_ && cells <= evaluated_cells_ * max_shrink) {
+                        return relayout;
+                    }
+                }
+
+                return choose_layout(points, lower, upper);
+            }
+
+            // Calls fn(bucket_index) for each bucket that may contain points
+            // within the spacing from pt.
+            template<typename Fn>
+            void for_each_adjacent_bucket(md::point pt, Fn fn) const
+            {
+                if (exact_) {
+                    for_each_cell_bucket(locate_cell_key(pt), fn);
+                    return;
+                }
+
+                if (binned_) {
+                    for_each_stencil_bucket(locate_binned_bucket(pt), fn);
+                    return;
+                }
+
+                uint32_t x, y, z;
+                locate_cell(pt, x, y, z);
+                for_each_hashed_bucket(hash(x, y, z), fn);
+            }
+
+            // Calls fn(neighbor_index) for each bucket adjoining to given one
+            // where each pair of adjoining buckets is enumerated only once.
+            template<typename Fn>
+            void for_each_directed_neighbor(size_t bucket_index, Fn fn) const
+            {
+                if (exact_) {
+                    for_each_cell_bucket(cells_.key(bucket_index), [&](size_t neighbor_index) {
+                        if (neighbor_index <= bucket_index) {
+                            fn(neighbor_index);
+                        }
+                    });
+                    return;
+                }
+
+                if (binned_) {
+                    for_each_stencil_bucket(bucket_index, [&](size_t neighbor_index) {
+                        if (neighbor_index <= bucket_index) {
+                            fn(neighbor_index);
+                        }
+                    });
+                    return;
+                }
+
+                // Leverage symmetry to reduce search space.
+                for_each_hashed_bucket(bucket_index, [&](size_t neighbor_index) {
+                    if (neighbor_index >= bucket_index) {
+                        fn(neighbor_index);
+                    }
+                });
+            }
+
+            // Shell enumeration below visits the same bucket more than once
+            // in hashing mode, where distinct cells may share a bucket.
+            static constexpr bool unique_shell_buckets = false;
+
+            // Returns the distance w such that all points closer than r*w to a
+            // point are in the shells 0, ..., r around the point.
+            md::scalar shell_width() const
+            {
+                return binned_ ? bin_step_ : spacing;
+            }
+
+            // Returns true if the shells 0, ..., r cover the whole grid. This
+            // is never the case with hashing.
+            bool covers_all(uint32_t r) const
+            {
+                return !exact_ && binned_ && x_count_ <= r + 1 && y_count_ <= r + 1 && z_count_ <= r + 1;
+            }
+
+            // Calls fn(bucket_index) for each bucket in the shell of cells at
+            // Chebyshev distance r from the cell containing pt. In exact mode
+            // all buckets are enumerated instead if the shell spans more cells
+            // than there are buckets.
+            template<typename Fn>
+            void for_each_shell_bucket(md::point pt, uint32_t r, Fn fn) const
+            {
+                if (exact_) {
+                    // A wide shell is mostly empty. Enumerating all buckets,
+                    // some of which are outside the shell, is cheaper then.
+                    auto const side = md::scalar(2 * r + 1);
+                    auto const inner = md::scalar(r == 0 ? 0 : 2 * r - 1);
+                    if (side * side * side - inner * inner * inner > md::scalar(cells_.size())) {
+                        for_each_bucket(fn);
+                        return;
+                    }
+
+                    auto const key = locate_cell_key(pt);
+                    for_each_shell_offset(r, [&](std::int64_t dx, std::int64_t dy, std::int64_t dz) {
+                        auto const bucket_index = cells_.find(cell_table::shift_key(key, dx, dy, dz));
+                        if (bucket_index != no_bucket) {
+                            fn(bucket_index);
+                        }
+                    });
+                    return;
+                }
+
+                std::int64_t x, y, z;
+                std::int64_t x_max, y_max, z_max;
+
+                if (binned_) {
+                    x = locate_clamped_bin(origin_.x, x_count_, pt.x);
+                    y = locate_clamped_bin(origin_.y, y_count_, pt.y);
+                    z = locate_clamped_bin(origin_.z, z_count_, pt.z);
+                    x_max = x_count_ - 1;
+                    y_max = y_count_ - 1;
+                    z_max = z_count_ - 1;
+                } else {
+                    uint32_t ux, uy, uz;
+                    locate_cell(pt, ux, uy, uz);
+                    x = ux;
+                    y = uy;
+                    z = uz;
+                    x_max = y_max = z_max = std::numeric_limits<uint32_t>::max();
+                }
+
+                for_each_shell_offset(r, [&](std::int64_t dx, std::int64_t dy, std::int64_t dz) {
+                    auto const cx = x + dx;
+                    auto const cy = y + dy;
+                    auto const cz = z + dz;
+
+                    if (cx < 0 || cy < 0 || cz < 0 || cx > x_max || cy > y_max || cz > z_max) {
+                        return;
+                    }
+
+                    if (binned_) {
+                        fn(do_locate_binned_bucket(uint32_t(cx), uint32_t(cy), uint32_t(cz)));
+                    } else {
+                        fn(size_t(hash(uint32_t(cx), uint32_t(cy), uint32_t(cz))));
+                    }
+                });
+            }
+
+            // Calls fn(bucket_index) for each distinct bucket that may contain
+            // points in the axis-aligned box [lower, upper]. All buckets are
+            // enumerated if the box spans more cells than there are buckets.
+            template<typename Fn>
+            void for_each_region_bucket(md::point lower, md::point upper, Fn fn) const
+            {
+                if (exact_) {
+                    if (!(count_cells(lower, upper, spacing) <= md::scalar(cells_.size()))) {
+                        for_each_bucket(fn);
+                        return;
+                    }
+
+                    auto const freq = 1 / spacing;
+                    auto const cell_span = [&](md::scalar lo, md::scalar hi) {
+                        return std::int64_t(std::floor(freq * hi)) - std::int64_t(std::floor(freq * lo));
+                    };
+                    auto const lower_key = locate_cell_key(lower);
+                    auto const dx_max = cell_span(lower.x, upper.x);
+                    auto const dy_max = cell_span(lower.y, upper.y);
+                    auto const dz_max = cell_span(lower.z, upper.z);
+
+                    for (std::int64_t dz = 0; dz <= dz_max; dz++) {
+                        for (std::int64_t dy = 0; dy <= dy_max; dy++) {
+                            for (std::int64_t dx = 0; dx <= dx_max; dx++) {
+                                auto const bucket_index = cells_.find(cell_table::shift_key(lower_key, dx, dy, dz));
+                                if (bucket_index != no_bucket) {
+                                    fn(bucket_index);
+                                }
+                            }
+                        }
+                    }
+                    return;
+                }
+
+                if (binned_) {
+                    auto const x_end = locate_clamped_bin(origin_.x, x_count_, upper.x);
+                    auto const y_end = locate_clamped_bin(origin_.y, y_count_, upper.y);
+                    auto const z_end = locate_clamped_bin(origin_.z, z_count_, upper.z);
+
+                    for (auto z = locate_clamped_bin(origin_.z, z_count_, lower.z); z <= z_end; z++) {
+                        for (auto y = locate_clamped_bin(origin_.y, y_count_, lower.y); y <= y_end; y++) {
+                            for (auto x = locate_clamped_bin(origin_.x, x_count_, lower.x); x <= x_end; x++) {
+                                fn(do_locate_binned_bucket(x, y, z));
+                            }
+                        }
+                    }
+                    return;
+                }
+
+                if (!(count_cells(lower, upper, spacing) <= md::scalar(hash.modulus))) {
+                    for_each_bucket(fn);
+                    return;
+                }
+
+                uint32_t x_begin, y_begin, z_begin;
+                uint32_t x_end, y_end, z_end;
+                locate_cell(lower, x_begin, y_begin, z_begin);
+                locate_cell(upper, x_end, y_end, z_end);
+
+                std::vector<size_t> buckets;
+                for (auto z = z_begin; z <= z_end; z++) {
+                    for (auto y = y_begin; y <= y_end; y++) {
+                        for (auto x = x_begin; x <= x_end; x++) {
+                            buckets.push_back(size_t(hash(x, y, z)));
+                        }
+                    }
+                }
+                sort_unique(buckets);
+
+                for (auto const bucket_index : buckets) {
+                    fn(bucket_index);
+                }
+            }
+
+        private:
+            // Calls fn(bucket_index) for each bucket.
+            template<typename Fn>
+            void for_each_bucket(Fn fn) const
+            {
+                for (size_t bucket_index = 0; bucket_index < bucket_count(); bucket_index++) {
+                    fn(bucket_index);
+                }
+            }
+
+            // Calls fn(dx, dy, dz) for each cell offset at Chebyshev distance r.
+            template<typename Fn>
+            static void for_each_shell_offset(uint32_t r, Fn fn)
+            {
+                auto const ir = std::int64_t(r);
+
+                for (auto dz = -ir; dz <= ir; dz++) {
+                    for (auto dy = -ir; dy <= ir; dy++) {
+                        for (auto dx = -ir; dx <= ir; dx++) {
+                            if (std::max({std::abs(dx), std::abs(dy), std::abs(dz)}) == ir) {
+                                fn(dx, dy, dz);
+                            }
+                        }
+                    }
+                }
+            }
+
+            // Refit is triggered when the point cloud grows or shrinks by this
+            // factor in terms of the number of cells in the bounding box.
+            static constexpr md::scalar max_shrink = 8;
+
+            // Binning is chosen if the bins are filled at least this much (in
+            // terms of points per bin)...
+            static constexpr md::scalar min_fill_factor = 0.25;
+
+            // ...or if hashing would put this fraction of occupied cells into
+            // buckets shared with other cells and the bins are not too sparse.
+            static constexpr md::scalar max_collision_rate = 0.5;
+            static constexpr md::scalar min_collision_fill_factor = 1.0 / 32;
+
+            // Capacity policy of the hash against changes in the hinted
+            // particle count. See reshape.
+            static constexpr md::index growth_factor = 2;
+            static constexpr md::index shrink_threshold = 4;
+
+            // Exact hashing tolerates this many empty cells in addition to
+            // twice the number of points before purging them.
+            static constexpr size_t min_stale_cells = 1024;
+
+            // Cell coordinates must be in [-max_cell_coord, max_cell_coord)
+            // for exact hashing. See cell_table.
+            static constexpr md::scalar max_cell_coord = 1 << 20;
+
+            inline void locate_cell(md::point pt, uint32_t& x, uint32_t& y, uint32_t& z) const
             {
                 // Negative coordinate value causes discontinuous jumps in hash value
                 // which breaks our search algorithm. Avoid that by offsetting. The
@@ -236,28 +1101,257 @@ namespace md
                 constexpr md::scalar offset = 1L << 20;
 
                 auto const freq = 1 / spacing;
-                auto const x = uint32_t(offset + freq * pt.x);
-                auto const y = uint32_t(offset + freq * pt.y);
-                auto const z = uint32_t(offset + freq * pt.z);
+                x = uint32_t(offset + freq * pt.x);
+                y = uint32_t(offset + freq * pt.y);
+                z = uint32_t(offset + freq * pt.z);
+            }
 
-                return hash(x, y, z);
+            // Computes the key of the cell containing pt for exact hashing.
+            inline uint64_t locate_cell_key(md::point pt) const
+            {
+                auto const freq = 1 / spacing;
+                return cell_table::make_key(
+                    std::int64_t(std::floor(freq * pt.x)),
+                    std::int64_t(std::floor(freq * pt.y)),
+                    std::int64_t(std::floor(freq * pt.z))
+                );
             }
 
-        private:
-            void init_hash(open_box box)
+            // Returns true if the cell containing pt has a key of its own.
+            // The test is done in floating point so that huge or non-finite
+            // coordinates are rejected before conversion to integers.
+            inline bool has_cell_key(md::point pt) const
             {
-                // This simple heuristic gives surprisingly good performance.
-                hash.modulus = md::linear_hash::uint(box.particle_count * 2 / 11);
-                hash.modulus |= 1;
+                auto const freq = 1 / spacing;
+                auto const in_range = [](md::scalar cell) {
+                    return cell >= -max_cell_coord && cell < max_cell_coord;
+                };
+                return in_range(std::floor(freq * pt.x))
+                    && in_range(std::floor(freq * pt.y))
+                    && in_range(std::floor(freq * pt.z));
+            }
+
+            // Adds buckets for the cells of the points that have none. Cells
+            // left empty are purged when they outnumber the points; purged is
+            // set in that case as the bucket assignments are changed. Returns
+            // false, leaving the table partially filled, if a point is out of
+            // the range of cell keys.
+            bool fit_cells(md::array_view<md::point const> points, bool& purged)
+            {
+                if (cells_.size() > 2 * points.size() + min_stale_cells) {
+                    cells_.clear();
+                    purged = true;
+                }
+
+                for (auto const pt : points) {
+                    if (!has_cell_key(pt)) {
+                        return false;
+                    }
+                    auto const key = locate_cell_key(pt);
+                    if (cells_.find(key) == no_bucket) {
+                        cells_.insert(key);
+                    }
+                }
+
+                return true;
+            }
+
+            // Calls fn(bucket_index) for each occupied cell in the 27 cells
+            // around the cell of given key.
+            template<typename Fn>
+            void for_each_cell_bucket(uint64_t key, Fn fn) const
+            {
+                for (std::int64_t dz = -1; dz <= 1; dz++) {
+                    for (std::int64_t dy = -1; dy <= 1; dy++) {
+                        for (std::int64_t dx = -1; dx <= 1; dx++) {
+                            auto const bucket_index = cells_.find(cell_table::shift_key(key, dx, dy, dz));
+                            if (bucket_index != no_bucket) {
+                                fn(bucket_index);
+                            }
+                        }
+                    }
+                }
+            }
+
+            // Calls fn(bucket_index) for each bucket where the 27 cells around
+            // a cell hashed to given bucket are hashed to. The hash is linear,
+            // so these buckets are obtained by adding precomputed deltas.
+            template<typename Fn>
+            void for_each_hashed_bucket(size_t center, Fn fn) const
+            {
+                for (auto const delta : hash_deltas_) {
+                    fn((center + delta) % hash.modulus);
+                }
+            }
+
+            // Calls fn(bucket_index) for each bin covered by the stencil
+            // centered at given bin. Unlike the periodic case, bins do not
+            // wrap around.
+            template<typename Fn>
+            void for_each_stencil_bucket(size_t bucket_index, Fn fn) const
+            {
+                auto const x = std::int64_t(bucket_index % x_count_);
+                auto const y = std::int64_t(bucket_index / x_count_ % y_count_);
+                auto const z = std::int64_t(bucket_index / x_count_ / y_count_);
+
+                for (auto const& offset : stencil_) {
+                    auto const adj_x = x + offset.dx;
+                    auto const adj_y = y + offset.dy;
+                    auto const adj_z = z + offset.dz;
+
+                    if (adj_x < 0 || adj_y < 0 || adj_z < 0 ||
+                        adj_x >= x_count_ || adj_y >= y_count_ || adj_z >= z_count_) {
+                        continue;
+                    }
+
+                    fn(do_locate_binned_bucket(uint32_t(adj_x), uint32_t(adj_y), uint32_t(adj_z)));
+                }
+            }
+
+            // Computes the index of the bin in which given coordinate value
+            // falls. Out-of-range values are clamped to the first or the last
+            // bin. Clamping keeps the bins of nearby points adjacent, so the
+            // search remains correct for points outside the bins.
+            inline uint32_t locate_clamped_bin(md::scalar origin, uint32_t count, md::scalar coord) const
+            {
+                auto const pos = (coord - origin) * (1 / bin_step_);
+                if (!(pos > 0)) {
+                    return 0;
+                }
+                if (pos >= md::scalar(count)) {
+                    return count - 1;
+                }
+                return trunc_uint(pos);
+            }
+
+            inline size_t locate_binned_bucket(md::point pt) const
+            {
+                auto const x = locate_clamped_bin(origin_.x, x_count_, pt.x);
+                auto const y = locate_clamped_bin(origin_.y, y_count_, pt.y);
+                auto const z = locate_clamped_bin(origin_.z, z_count_, pt.z);
+                return do_locate_binned_bucket(x, y, z);
+            }
+
+            size_t do_locate_binned_bucket(uint32_t x, uint32_t y, uint32_t z) const
+            {
+                return x + size_t(x_count_) * (y + size_t(y_count_) * z);
+            }
+
+            // Returns the number of cells of given width in the bounding box.
+            static md::scalar count_cells(md::point lower, md::point upper, md::scalar step)
+            {
+                auto const span = upper - lower;
+                return (std::floor(span.x / step) + 1)
+                     * (std::floor(span.y / step) + 1)
+                     * (std::floor(span.z / step) + 1);
+            }
+
+            // Chooses hashing or binning based on the fill factor of the bins
+            // and the collision rate of the hash measured on the points.
+            // Returns true if the bucket layout has changed.
+            bool choose_layout(
+                md::array_view<md::point const> points, md::point lower, md::point upper
+            )
+            {
+                evaluated_cells_ = count_cells(lower, upper, spacing);
+
+                // Leave some margin for the point cloud to move around.
+                auto const margin = 0.1 * (upper - lower) + md::vector{spacing, spacing, spacing};
+                auto const bin_lower = lower - margin;
+                auto const bin_upper = upper + margin;
+
+                // The choice is made on spacing-wide cells regardless of the
+                // subdivision, which only refines the bins.
+                auto const cells = count_cells(bin_lower, bin_upper, spacing);
+                auto const point_count = md::scalar(points.size());
+
+                bool use_binning = false;
+
+                if (cells * min_collision_fill_factor <= point_count) {
+                    auto const span = bin_upper - bin_lower;
+
+                    if (cells * min_fill_factor <= point_count) {
+                        use_binning = true;
+                    } else {
+                        use_binning = measure_collision_rate(points, bin_lower, span) >= max_collision_rate;
+                    }
+
+                    if (use_binning) {
+                        uint32_t const x_count = trunc_uint(span.x / bin_step_) + 1;
+                        uint32_t const y_count = trunc_uint(span.y / bin_step_) + 1;
+                        uint32_t const z_count = trunc_uint(span.z / bin_step_) + 1;
+
+                        binned_ = true;
+                        origin_ = bin_lower;
+                        x_count_ = x_count;
+                        y_count_ = y_count;
+                        z_count_ = z_count;
+
+                        // Changed origin alters bucket assignment.
+                        return true;
+                    }
+                }
+
+                if (binned_) {
+                    binned_ = false;
+                    return true;
+                }
+
+                return false;
             }
 
-            void init_buckets()
+            // Measures the fraction of occupied cells that share a hash bucket
+            // with another occupied cell.
+            md::scalar measure_collision_rate(
+                md::array_view<md::point const> points,
+                md::point lower,
+                md::vector span
+            ) const
+            {
+                uint32_t const x_count = trunc_uint(span.x / spacing) + 1;
+                uint32_t const y_count = trunc_uint(span.y / spacing) + 1;
+
+                std::vector<uint64_t> cells;
+                cells.reserve(points.size());
+
+                for (auto const pt : points) {
+                    auto const x = uint64_t(trunc_uint((pt.x - lower.x) / spacing));
+                    auto const y = uint64_t(trunc_uint((pt.y - lower.y) / spacing));
+                    auto const z = uint64_t(trunc_uint((pt.z - lower.z) / spacing));
+                    cells.push_back(x + x_count * (y + y_count * z));
+                }
+                sort_unique(cells);
+
+                std::vector<uint32_t> loads(hash.modulus);
+                for (auto const cell : cells) {
+                    auto const x = uint32_t(cell % x_count);
+                    auto const y = uint32_t(cell / x_count % y_count);
+                    auto const z = uint32_t(cell / x_count / y_count);
+                    loads[hash(x, y, z)]++;
+                }
+
+                md::index collided = 0;
+                for (auto const load : loads) {
+                    if (load > 1) {
+                        collided += load;
+                    }
+                }
+
+                return md::scalar(collided) / md::scalar(cells.size());
+            }
+
+            static md::linear_hash::uint hash_modulus(md::index capacity)
             {
-                buckets.resize(hash.modulus);
+                // This simple heuristic gives surprisingly good performance.
+                return md::linear_hash::uint(capacity * 2 / 11) | 1;
+            }
 
-                // Compute neighbor graph of the spatial cells.
-                std::vector<uint32_t> hash_deltas;
+            void init_hash(md::index capacity)
+            {
+                hash.modulus = hash_modulus(capacity);
+                hash_deltas_.clear();
 
+                // Deltas of the hash values of the 27 cells around a cell.
                 uint32_t const coord_deltas[] = {
                     hash.modulus - 1,
                     hash.modulus,
@@ -267,31 +1361,27 @@ namespace md
                 for (auto const dx : coord_deltas) {
                     for (auto const dy : coord_deltas) {
                         for (auto const dz : coord_deltas) {
-                            hash_deltas.push_back(hash(dx, dy, dz));
+                            hash_deltas_.push_back(hash(dx, dy, dz));
                         }
                     }
                 }
 
-                sort_unique(hash_deltas);
-
-                for (uint32_t center = 0; center < hash.modulus; center++) {
-                    auto& directed_neighbors = buckets[center].directed_neighbors;
-                    auto& complete_neighbors = buckets[center].complete_neighbors;
-
-                    for (auto const delta : hash_deltas) {
-                        auto const neighbor = (center + delta) % hash.modulus;
-
-                        // Leverage symmetry to reduce search space.
-                        if (neighbor >= center) {
-                            directed_neighbors.push_back(neighbor);
-                        }
-                        complete_neighbors.push_back(neighbor);
-                    }
-
-                    sort_unique(directed_neighbors);
-                    sort_unique(complete_neighbors);
-                }
+                sort_unique(hash_deltas_);
             }
+        private:
+            md::scalar bin_step_;
+            std::vector<cell_offset> stencil_;
+            bool exact_;
+            cell_table cells_;
+            md::index capacity_ = 0;
+            bool relayout_ = false;
+            std::vector<uint32_t> hash_deltas_;
+            bool binned_ = false;
+            md::scalar evaluated_cells_ = 0;
+            md::point origin_;
+            uint32_t x_count_ = 0;
+            uint32_t y_count_ = 0;
+            uint32_t z_count_ = 0;
         };
     }
 }
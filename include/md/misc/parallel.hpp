@@ -0,0 +1,78 @@
+// Copyright snsinfu 2019.
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef MD_MISC_PARALLEL_HPP
+#define MD_MISC_PARALLEL_HPP
+
+// This module provides a minimal fork-join helper for splitting a loop over
+// an index range into contiguous chunks processed by worker threads.
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include "../basic_types.hpp"
+
+
+namespace md
+{
+    // `default_thread_count` returns the number of concurrent threads supported
+    // by the hardware, or 1 if the number is unknown.
+    inline md::index default_thread_count()
+    {
+        auto const count = std::thread::hardware_concurrency();
+        return count > 0 ? md::index(count) : 1;
+    }
+
+    // `parallel_for_chunks` splits the index range [0, n) into `thread_count`
+    // contiguous chunks of roughly equal size and calls `fn(chunk, begin, end)`
+    // on each chunk in parallel. The first chunk is processed by the calling
+    // thread. Chunks are numbered in the order of the range, so the caller can
+    // merge per-chunk outputs in the same order as a serial loop. An exception
+    // thrown from any chunk is rethrown after all threads are joined.
+    template<typename Fn>
+    void parallel_for_chunks(md::index thread_count, md::index n, Fn fn)
+    {
+        thread_count = std::max(std::min(thread_count, n), md::index(1));
+
+        auto chunk_begin = [=](md::index chunk) {
+            return n / thread_count * chunk + std::min(chunk, n % thread_count);
+        };
+
+        if (thread_count == 1) {
+            fn(md::index(0), md::index(0), n);
+            return;
+        }
+
+        std::vector<std::exception_ptr> errors(thread_count);
+        std::vector<std::thread> workers;
+        workers.reserve(thread_count - 1);
+
+        auto run_chunk = [&](md::index chunk) {
+            try {
+                fn(chunk, chunk_begin(chunk), chunk_begin(chunk + 1));
+            } catch (...) {
+                errors[chunk] = std::current_exception();
+            }
+        };
+
+        for (md::index chunk = 1; chunk < thread_count; chunk++) {
+            workers.emplace_back(run_chunk, chunk);
+        }
+        run_chunk(0);
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        for (auto const& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+}
+
+#endif
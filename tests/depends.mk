@@ -8,9 +8,16 @@ forcefield/detail/test_neighbor_list.o: \
   ../include/md/forcefield/detail/neighbor_list_heuristics.hpp \
   ../include/md/misc/box.hpp \
   ../include/md/misc/linear_hash.hpp \
+  ../include/md/misc/multilevel_neighbor_searcher.hpp \
+  ../include/md/misc/neighbor_search_options.hpp \
   ../include/md/misc/neighbor_searcher.hpp \
+  ../include/md/misc/nsearch_detail/box_traits.hpp \
+  ../include/md/misc/nsearch_detail/cell_table.hpp \
+  ../include/md/misc/nsearch_detail/distance_kernel.hpp \
   ../include/md/misc/nsearch_detail/math.hpp \
+  ../include/md/misc/nsearch_detail/quantize.hpp \
   ../include/md/misc/nsearch_detail/search_grid.hpp \
+  ../include/md/misc/parallel.hpp \
   forcefield/detail/test_neighbor_list.cc
 forcefield/test_bonded_pairwise_forcefield.o: \
   ../include/md/basic_types.hpp \
@@ -105,6 +112,46 @@ forcefield/test_ellipsoid_surface_forcefield.o: \
   ../include/md/system/detail/type_hash.hpp \
   ../include/md/system/particle.hpp \
   forcefield/test_ellipsoid_surface_forcefield.cc
+forcefield/test_neighbor_list_registry.o: \
+  ../include/md/basic_types.hpp \
+  ../include/md/basic_types/array_view.hpp \
+  ../include/md/basic_types/point.hpp \
+  ../include/md/basic_types/sfc.hpp \
+  ../include/md/basic_types/ziggurat.hpp \
+  ../include/md/forcefield.hpp \
+  ../include/md/forcefield/detail/neighbor_list.hpp \
+  ../include/md/forcefield/detail/neighbor_list_heuristics.hpp \
+  ../include/md/forcefield/detail/pair_potfun.hpp \
+  ../include/md/forcefield/neighbor_list_registry.hpp \
+  ../include/md/forcefield/neighbor_pairwise_forcefield.hpp \
+  ../include/md/misc/box.hpp \
+  ../include/md/misc/index_range.hpp \
+  ../include/md/misc/linear_hash.hpp \
+  ../include/md/misc/math.hpp \
+  ../include/md/misc/multilevel_neighbor_searcher.hpp \
+  ../include/md/misc/neighbor_search_options.hpp \
+  ../include/md/misc/neighbor_searcher.hpp \
+  ../include/md/misc/nsearch_detail/box_traits.hpp \
+  ../include/md/misc/nsearch_detail/cell_table.hpp \
+  ../include/md/misc/nsearch_detail/distance_kernel.hpp \
+  ../include/md/misc/nsearch_detail/math.hpp \
+  ../include/md/misc/nsearch_detail/quantize.hpp \
+  ../include/md/misc/nsearch_detail/search_grid.hpp \
+  ../include/md/misc/parallel.hpp \
+  ../include/md/potential/constant_potential.hpp \
+  ../include/md/potential/softcore_potential.hpp \
+  ../include/md/simulation/brownian_dynamics.hpp \
+  ../include/md/simulation/detail/brownian_simulator.hpp \
+  ../include/md/simulation/detail/brownian_timestepper.hpp \
+  ../include/md/system.hpp \
+  ../include/md/system/attribute.hpp \
+  ../include/md/system/detail/array_erasure.hpp \
+  ../include/md/system/detail/attribute_table.hpp \
+  ../include/md/system/detail/iterator_range.hpp \
+  ../include/md/system/detail/sum_forcefield.hpp \
+  ../include/md/system/detail/type_hash.hpp \
+  ../include/md/system/particle.hpp \
+  forcefield/test_neighbor_list_registry.cc
 forcefield/test_neighbor_pairwise_forcefield.o: \
   ../include/md/basic_types.hpp \
   ../include/md/basic_types/array_view.hpp \
@@ -115,14 +162,22 @@ forcefield/test_neighbor_pairwise_forcefield.o: \
   ../include/md/forcefield/detail/neighbor_list.hpp \
   ../include/md/forcefield/detail/neighbor_list_heuristics.hpp \
   ../include/md/forcefield/detail/pair_potfun.hpp \
+  ../include/md/forcefield/neighbor_list_registry.hpp \
   ../include/md/forcefield/neighbor_pairwise_forcefield.hpp \
   ../include/md/misc/box.hpp \
   ../include/md/misc/index_range.hpp \
   ../include/md/misc/linear_hash.hpp \
   ../include/md/misc/math.hpp \
+  ../include/md/misc/multilevel_neighbor_searcher.hpp \
+  ../include/md/misc/neighbor_search_options.hpp \
   ../include/md/misc/neighbor_searcher.hpp \
+  ../include/md/misc/nsearch_detail/box_traits.hpp \
+  ../include/md/misc/nsearch_detail/cell_table.hpp \
+  ../include/md/misc/nsearch_detail/distance_kernel.hpp \
   ../include/md/misc/nsearch_detail/math.hpp \
+  ../include/md/misc/nsearch_detail/quantize.hpp \
   ../include/md/misc/nsearch_detail/search_grid.hpp \
+  ../include/md/misc/parallel.hpp \
   ../include/md/potential/harmonic_potential.hpp \
   ../include/md/potential/softcore_potential.hpp \
   ../include/md/system.hpp \
@@ -232,6 +287,7 @@ integration_tests/test_persistence_length.o: \
   ../include/md/forcefield/detail/pair_potfun.hpp \
   ../include/md/forcefield/detail/triple_potfun.hpp \
   ../include/md/forcefield/ellipsoid_surface_forcefield.hpp \
+  ../include/md/forcefield/neighbor_list_registry.hpp \
   ../include/md/forcefield/neighbor_pairwise_forcefield.hpp \
   ../include/md/forcefield/plane_surface_forcefield.hpp \
   ../include/md/forcefield/point_source_forcefield.hpp \
@@ -240,9 +296,16 @@ integration_tests/test_persistence_length.o: \
   ../include/md/misc/index_range.hpp \
   ../include/md/misc/linear_hash.hpp \
   ../include/md/misc/math.hpp \
+  ../include/md/misc/multilevel_neighbor_searcher.hpp \
+  ../include/md/misc/neighbor_search_options.hpp \
   ../include/md/misc/neighbor_searcher.hpp \
+  ../include/md/misc/nsearch_detail/box_traits.hpp \
+  ../include/md/misc/nsearch_detail/cell_table.hpp \
+  ../include/md/misc/nsearch_detail/distance_kernel.hpp \
   ../include/md/misc/nsearch_detail/math.hpp \
+  ../include/md/misc/nsearch_detail/quantize.hpp \
   ../include/md/misc/nsearch_detail/search_grid.hpp \
+  ../include/md/misc/parallel.hpp \
   ../include/md/potential/constant_potential.hpp \
   ../include/md/potential/cosine_bending_potential.hpp \
   ../include/md/potential/cutoff_potential.hpp \
@@ -263,6 +326,7 @@ integration_tests/test_persistence_length.o: \
   ../include/md/simulation/brownian_dynamics.hpp \
   ../include/md/simulation/detail/brownian_simulator.hpp \
   ../include/md/simulation/detail/brownian_timestepper.hpp \
+  ../include/md/simulation/langevin_dynamics.hpp \
   ../include/md/simulation/newtonian_dynamics.hpp \
   ../include/md/system.hpp \
   ../include/md/system/attribute.hpp \
@@ -275,6 +339,20 @@ integration_tests/test_persistence_length.o: \
   integration_tests/test_persistence_length.cc
 main.o: \
   main.cc
+misc/nsearch_detail/test_cell_table.o: \
+  ../include/md/misc/nsearch_detail/cell_table.hpp \
+  misc/nsearch_detail/test_cell_table.cc
+misc/nsearch_detail/test_distance_kernel.o: \
+  ../include/md/basic_types.hpp \
+  ../include/md/basic_types/array_view.hpp \
+  ../include/md/basic_types/point.hpp \
+  ../include/md/basic_types/sfc.hpp \
+  ../include/md/basic_types/ziggurat.hpp \
+  ../include/md/misc/box.hpp \
+  ../include/md/misc/nsearch_detail/box_traits.hpp \
+  ../include/md/misc/nsearch_detail/distance_kernel.hpp \
+  ../include/md/misc/nsearch_detail/math.hpp \
+  misc/nsearch_detail/test_distance_kernel.cc
 misc/test_box.o: \
   ../include/md/basic_types.hpp \
   ../include/md/basic_types/array_view.hpp \
@@ -303,6 +381,25 @@ misc/test_math.o: \
   ../include/md/basic_types/ziggurat.hpp \
   ../include/md/misc/math.hpp \
   misc/test_math.cc
+misc/test_multilevel_neighbor_searcher.o: \
+  ../include/md/basic_types.hpp \
+  ../include/md/basic_types/array_view.hpp \
+  ../include/md/basic_types/point.hpp \
+  ../include/md/basic_types/sfc.hpp \
+  ../include/md/basic_types/ziggurat.hpp \
+  ../include/md/misc/box.hpp \
+  ../include/md/misc/linear_hash.hpp \
+  ../include/md/misc/multilevel_neighbor_searcher.hpp \
+  ../include/md/misc/neighbor_search_options.hpp \
+  ../include/md/misc/neighbor_searcher.hpp \
+  ../include/md/misc/nsearch_detail/box_traits.hpp \
+  ../include/md/misc/nsearch_detail/cell_table.hpp \
+  ../include/md/misc/nsearch_detail/distance_kernel.hpp \
+  ../include/md/misc/nsearch_detail/math.hpp \
+  ../include/md/misc/nsearch_detail/quantize.hpp \
+  ../include/md/misc/nsearch_detail/search_grid.hpp \
+  ../include/md/misc/parallel.hpp \
+  misc/test_multilevel_neighbor_searcher.cc
 misc/test_neighbor_searcher.o: \
   ../include/md/basic_types.hpp \
   ../include/md/basic_types/array_view.hpp \
@@ -311,9 +408,15 @@ misc/test_neighbor_searcher.o: \
   ../include/md/basic_types/ziggurat.hpp \
   ../include/md/misc/box.hpp \
   ../include/md/misc/linear_hash.hpp \
+  ../include/md/misc/neighbor_search_options.hpp \
   ../include/md/misc/neighbor_searcher.hpp \
+  ../include/md/misc/nsearch_detail/box_traits.hpp \
+  ../include/md/misc/nsearch_detail/cell_table.hpp \
+  ../include/md/misc/nsearch_detail/distance_kernel.hpp \
   ../include/md/misc/nsearch_detail/math.hpp \
+  ../include/md/misc/nsearch_detail/quantize.hpp \
   ../include/md/misc/nsearch_detail/search_grid.hpp \
+  ../include/md/misc/parallel.hpp \
   misc/test_neighbor_searcher.cc
 potential/test_constant_potential.o: \
   ../include/md/basic_types.hpp \
@@ -480,6 +583,23 @@ simulation/test_brownian_dynamics.o: \
   ../include/md/system/detail/type_hash.hpp \
   ../include/md/system/particle.hpp \
   simulation/test_brownian_dynamics.cc
+simulation/test_langevin_dynamics.o: \
+  ../include/md/basic_types.hpp \
+  ../include/md/basic_types/array_view.hpp \
+  ../include/md/basic_types/point.hpp \
+  ../include/md/basic_types/sfc.hpp \
+  ../include/md/basic_types/ziggurat.hpp \
+  ../include/md/forcefield.hpp \
+  ../include/md/simulation/langevin_dynamics.hpp \
+  ../include/md/system.hpp \
+  ../include/md/system/attribute.hpp \
+  ../include/md/system/detail/array_erasure.hpp \
+  ../include/md/system/detail/attribute_table.hpp \
+  ../include/md/system/detail/iterator_range.hpp \
+  ../include/md/system/detail/sum_forcefield.hpp \
+  ../include/md/system/detail/type_hash.hpp \
+  ../include/md/system/particle.hpp \
+  simulation/test_langevin_dynamics.cc
 simulation/test_newtonian_dynamics.o: \
   ../include/md/basic_types.hpp \
   ../include/md/basic_types/array_view.hpp \
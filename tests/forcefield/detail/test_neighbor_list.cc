@@ -91,6 +91,680 @@ TEST_CASE("neighbor_list - finds correct neighbor pairs")
         box.y_period = 1.0;
         test_on_box(box);
     }
+
+    SECTION("in z_periodic_box")
+    {
+        md::z_periodic_box box;
+        box.z_period = 1.1;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_list::set_layout - stores the same pairs in csr rows")
+{
+    md::scalar const cutoff_distance = 0.1;
+    md::index const point_count = 1000;
+
+    std::vector<md::point> points;
+    std::mt19937 random;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        std::uniform_real_distribution<md::scalar> coord;
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::periodic_box box;
+    box.x_period = 1;
+    box.y_period = 1;
+    box.z_period = 1;
+
+    auto test_on_targets = [&](std::vector<md::index> const& targets) {
+        md::neighbor_list<md::periodic_box> pair_list;
+        pair_list.set_targets(targets);
+        pair_list.update(points, cutoff_distance, box);
+        std::set<std::pair<md::index, md::index>> const expect(pair_list.begin(), pair_list.end());
+
+        md::neighbor_list<md::periodic_box> csr_list;
+        csr_list.set_targets(targets);
+        csr_list.set_layout(md::neighbor_list_layout::csr);
+        CHECK(csr_list.layout() == md::neighbor_list_layout::csr);
+        csr_list.update(points, cutoff_distance, box);
+
+        CHECK(csr_list.begin() == csr_list.end());
+
+        auto const rows = csr_list.rows();
+        auto const offsets = csr_list.offsets();
+        auto const neighbors = csr_list.neighbors();
+        REQUIRE(offsets.size() == rows.size() + 1);
+        CHECK(offsets[rows.size()] == neighbors.size());
+
+        // Each point owns at most one non-empty row.
+        CHECK(std::set<md::index>(rows.begin(), rows.end()).size() == rows.size());
+
+        std::set<std::pair<md::index, md::index>> actual;
+        for (md::index row = 0; row < rows.size(); row++) {
+            md::index const i = rows[row];
+            CHECK(offsets[row] < offsets[row + 1]);
+
+            for (md::index n = offsets[row]; n < offsets[row + 1]; n++) {
+                CHECK(i < neighbors[n]);
+                actual.emplace(i, neighbors[n]);
+            }
+        }
+        CHECK(actual.size() == neighbors.size());
+        CHECK(actual == expect);
+    };
+
+    SECTION("all points")
+    {
+        test_on_targets({});
+    }
+
+    SECTION("targets")
+    {
+        std::vector<md::index> targets;
+        for (md::index i = 0; i < point_count; i += 3) {
+            targets.push_back(i);
+        }
+        test_on_targets(targets);
+    }
+}
+
+TEST_CASE("neighbor_list::set_layout - lists pairs in both directions in full rows")
+{
+    md::scalar const cutoff_distance = 0.1;
+    md::index const point_count = 1000;
+
+    std::vector<md::point> points;
+    std::mt19937 random;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        std::uniform_real_distribution<md::scalar> coord;
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::open_box box;
+
+    md::neighbor_list<md::open_box> pair_list;
+    pair_list.update(points, cutoff_distance, box);
+
+    std::set<std::pair<md::index, md::index>> expect;
+    for (auto const& pair : pair_list) {
+        expect.emplace(pair.first, pair.second);
+        expect.emplace(pair.second, pair.first);
+    }
+
+    md::neighbor_list<md::open_box> full_list;
+    full_list.set_layout(md::neighbor_list_layout::full);
+    full_list.update(points, cutoff_distance, box);
+
+    auto const rows = full_list.rows();
+    auto const offsets = full_list.offsets();
+    auto const neighbors = full_list.neighbors();
+    REQUIRE(offsets.size() == rows.size() + 1);
+    CHECK(std::set<md::index>(rows.begin(), rows.end()).size() == rows.size());
+
+    std::set<std::pair<md::index, md::index>> actual;
+    for (md::index row = 0; row < rows.size(); row++) {
+        for (md::index n = offsets[row]; n < offsets[row + 1]; n++) {
+            actual.emplace(rows[row], neighbors[n]);
+        }
+    }
+    CHECK(actual.size() == neighbors.size());
+    CHECK(actual == expect);
+}
+
+TEST_CASE("neighbor_list - stays correct as points are wrapped around periodic boundaries")
+{
+    md::scalar const cutoff_distance = 0.1;
+    md::index const point_count = 1000;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord;
+    std::normal_distribution<md::scalar> step{0, 0.002};
+
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::periodic_box box;
+    box.x_period = 1;
+    box.y_period = 1;
+    box.z_period = 1;
+
+    md::neighbor_list<md::periodic_box> list;
+
+    for (int round = 0; round < 5; round++) {
+        list.update(points, cutoff_distance, box);
+
+        std::set<std::pair<md::index, md::index>> expect;
+        for (md::index i = 0; i < points.size(); i++) {
+            for (md::index j = i + 1; j < points.size(); j++) {
+                if (box.shortest_displacement(points[i], points[j]).norm() < cutoff_distance) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+
+        std::set<std::pair<md::index, md::index>> actual;
+        for (auto pair : list) {
+            actual.insert(pair);
+        }
+
+        CHECK(std::includes(
+            actual.begin(), actual.end(), expect.begin(), expect.end()
+        ));
+
+        // Small moves, and jumps to other images for some points.
+        for (md::index i = 0; i < points.size(); i++) {
+            points[i] += {step(random), step(random), step(random)};
+            if (i % 7 == md::index(round)) {
+                points[i].x += (i % 2 == 0 ? 1 : -1);
+            }
+        }
+    }
+}
+
+TEST_CASE("neighbor_list - tunes verlet factor within bounds")
+{
+    md::scalar const cutoff_distance = 0.1;
+    md::index const point_count = 1000;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord;
+    std::normal_distribution<md::scalar> step{0, 0.005};
+
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::periodic_box box;
+    box.x_period = 1;
+    box.y_period = 1;
+    box.z_period = 1;
+
+    auto run = [&](md::neighbor_list<md::periodic_box>& list, md::scalar pair_loop_time) {
+        for (int round = 0; round < 200; round++) {
+            list.update(points, cutoff_distance, box);
+            list.record_pair_loop(pair_loop_time);
+
+            for (auto& point : points) {
+                point += {step(random), step(random), step(random)};
+            }
+        }
+
+        std::set<std::pair<md::index, md::index>> expect;
+        for (md::index i = 0; i < points.size(); i++) {
+            for (md::index j = i + 1; j < points.size(); j++) {
+                if (box.shortest_displacement(points[i], points[j]).norm() < cutoff_distance) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+
+        list.update(points, cutoff_distance, box);
+        std::set<std::pair<md::index, md::index>> actual(list.begin(), list.end());
+        CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+    };
+
+    SECTION("default")
+    {
+        md::neighbor_list<md::periodic_box> list;
+
+        // Tuning is disabled by default.
+        run(list, 1.0);
+        CHECK(list.verlet_factor() == Approx(1.5));
+        CHECK(list.tuning_history().empty());
+    }
+
+    SECTION("free pair loops")
+    {
+        md::neighbor_list<md::periodic_box> list;
+        list.set_verlet_tuning(true);
+        CHECK(list.verlet_factor() == Approx(1.5));
+        CHECK(list.tuning_history().empty());
+
+        // Free pair loops give the classic v^3/(v-1) optimum.
+        run(list, 0);
+        CHECK(list.verlet_factor() == Approx(1.5));
+        REQUIRE(!list.tuning_history().empty());
+
+        for (auto const& record : list.tuning_history()) {
+            CHECK(record.verlet_factor == Approx(1.5));
+            CHECK(record.update_count >= 1);
+            CHECK(record.rebuild_time > 0);
+            CHECK(record.pair_loop_time == 0);
+        }
+    }
+
+    SECTION("expensive pair loops")
+    {
+        md::neighbor_list<md::periodic_box> list;
+        list.set_verlet_tuning(true);
+        list.set_verlet_factor_bounds(1.1, 2.0);
+
+        // Slow pair loops shrink the skin down to the lower bound.
+        run(list, 1.0);
+        CHECK(list.verlet_factor() == Approx(1.1));
+
+        auto const& history = list.tuning_history();
+        REQUIRE(!history.empty());
+        CHECK(history.front().verlet_factor == Approx(1.5));
+        CHECK(history.front().pair_loop_time == Approx(1.0));
+        CHECK(history.back().next_verlet_factor == Approx(1.1));
+    }
+
+    SECTION("changed box")
+    {
+        md::neighbor_list<md::periodic_box> list;
+        list.set_verlet_tuning(true);
+        list.update(points, cutoff_distance, box);
+
+        // A list invalidated by a box change says nothing about its lifetime.
+        auto resized_box = box;
+        resized_box.x_period = 1.1;
+        list.update(points, cutoff_distance, resized_box);
+        CHECK(list.tuning_history().empty());
+    }
+
+    SECTION("fixed factor")
+    {
+        md::neighbor_list<md::periodic_box> list;
+        list.set_verlet_tuning(true);
+        list.set_verlet_factor_bounds(1.25, 1.25);
+        CHECK(list.verlet_factor() == Approx(1.25));
+
+        run(list, 1.0);
+        CHECK(list.verlet_factor() == Approx(1.25));
+    }
+}
+
+TEST_CASE("neighbor_list - tunes verlet factor with boxes given without hints")
+{
+    md::scalar const cutoff_distance = 0.1;
+    md::index const point_count = 500;
+
+    // Boxes are given as a forcefield would, without particle_count and
+    // spans, which the list fills in for itself.
+    auto test_on_box = [&](auto box) {
+        using box_type = decltype(box);
+
+        std::mt19937 random;
+        std::uniform_real_distribution<md::scalar> coord;
+        std::normal_distribution<md::scalar> step{0, 0.001};
+
+        std::vector<md::point> points;
+        std::generate_n(std::back_inserter(points), point_count, [&] {
+            return md::point{coord(random), coord(random), coord(random)};
+        });
+
+        md::neighbor_list<box_type> list;
+        list.set_verlet_tuning(true);
+
+        int const rounds = 200;
+        for (int round = 0; round < rounds; round++) {
+            list.update(points, cutoff_distance, box);
+            list.record_pair_loop(0);
+
+            for (auto& point : points) {
+                point += {step(random), step(random), step(random)};
+            }
+        }
+
+        CHECK(list.rebuild_count() < rounds / 4);
+        CHECK(!list.tuning_history().empty());
+    };
+
+    SECTION("open_box")
+    {
+        test_on_box(md::open_box{});
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        test_on_box(box);
+    }
+
+    SECTION("z_periodic_box")
+    {
+        md::z_periodic_box box;
+        box.z_period = 1;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_list - reuses z_periodic_box list across small displacements")
+{
+    md::scalar const cutoff_distance = 0.1;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord;
+    std::uniform_real_distribution<md::scalar> step{-0.002, 0.002};
+
+    // A fiber along the periodic z axis.
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), 500, [&] {
+        return md::point{0.2 * coord(random), 0.2 * coord(random), coord(random)};
+    });
+
+    md::z_periodic_box box;
+    box.z_period = 1;
+
+    md::neighbor_list<md::z_periodic_box> list;
+    list.update(points, cutoff_distance, box);
+    CHECK(list.rebuild_count() == 1);
+
+    for (int round = 0; round < 5; round++) {
+        for (auto& point : points) {
+            point += {step(random), step(random), step(random)};
+        }
+        list.update(points, cutoff_distance, box);
+    }
+    CHECK(list.rebuild_count() == 1);
+
+    std::set<std::pair<md::index, md::index>> expect;
+    for (md::index i = 0; i < points.size(); i++) {
+        for (md::index j = i + 1; j < points.size(); j++) {
+            if (box.shortest_displacement(points[i], points[j]).norm() < cutoff_distance) {
+                expect.emplace(i, j);
+            }
+        }
+    }
+    std::set<std::pair<md::index, md::index>> const actual(list.begin(), list.end());
+    CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+}
+
+TEST_CASE("neighbor_list - rebuilds open_box list once per particle insertion")
+{
+    md::scalar const cutoff_distance = 0.1;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord;
+    std::uniform_real_distribution<md::scalar> step{-0.002, 0.002};
+
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), 500, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::open_box box;
+    md::neighbor_list<md::open_box> list;
+
+    auto move_points = [&] {
+        for (auto& point : points) {
+            point += {step(random), step(random), step(random)};
+        }
+        list.update(points, cutoff_distance, box);
+    };
+
+    list.update(points, cutoff_distance, box);
+    move_points();
+    move_points();
+    CHECK(list.rebuild_count() == 1);
+
+    // The new particle needs a new list. The list is reused afterwards.
+    points.push_back({coord(random), coord(random), coord(random)});
+    list.update(points, cutoff_distance, box);
+    CHECK(list.rebuild_count() == 2);
+
+    move_points();
+    move_points();
+    CHECK(list.rebuild_count() == 2);
+
+    std::set<std::pair<md::index, md::index>> expect;
+    for (md::index i = 0; i < points.size(); i++) {
+        for (md::index j = i + 1; j < points.size(); j++) {
+            if (md::distance(points[i], points[j]) < cutoff_distance) {
+                expect.emplace(i, j);
+            }
+        }
+    }
+    std::set<std::pair<md::index, md::index>> const actual(list.begin(), list.end());
+    CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+}
+
+TEST_CASE("verlet_tuner::tune - shrinks the skin if rebuilds are free")
+{
+    md::detail::verlet_tuner tuner;
+    tuner.set_enabled(true);
+    tuner.set_bounds(1.1, 2.0);
+
+    for (int round = 0; round < 20; round++) {
+        tuner.start(0);
+        tuner.count_update();
+        tuner.add_pair_loop(0.5);
+        tuner.tune();
+    }
+    CHECK(tuner.verlet_factor() == Approx(1.1).epsilon(0.05));
+
+    REQUIRE(!tuner.history().empty());
+    CHECK(tuner.history().front().verlet_factor == Approx(1.5));
+    CHECK(tuner.history().front().next_verlet_factor == Approx(1.3));
+    CHECK(tuner.history().front().pair_loop_time == Approx(0.25));
+}
+
+TEST_CASE("neighbor_list::set_background_rebuild - switches to lists built in background")
+{
+    md::scalar const cutoff_distance = 0.15;
+    md::index const point_count = 400;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord;
+    std::normal_distribution<md::scalar> step{0, 0.004};
+
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::periodic_box box;
+    box.x_period = 1;
+    box.y_period = 1;
+    box.z_period = 1;
+
+    md::neighbor_list<md::periodic_box> list;
+    list.set_background_rebuild(true);
+
+    for (int round = 0; round < 200; round++) {
+        list.update(points, cutoff_distance, box);
+
+        std::set<std::pair<md::index, md::index>> expect;
+        for (md::index i = 0; i < points.size(); i++) {
+            for (md::index j = i + 1; j < points.size(); j++) {
+                if (box.shortest_displacement(points[i], points[j]).norm() < cutoff_distance) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+
+        std::set<std::pair<md::index, md::index>> const actual(list.begin(), list.end());
+        CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+
+        for (auto& point : points) {
+            point += {step(random), step(random), step(random)};
+        }
+    }
+
+    CHECK(list.background_switch_count() > 0);
+
+    // Copies do not take over the list being built in background.
+    for (int round = 0; round < 200 && !list.background_rebuild_pending(); round++) {
+        for (auto& point : points) {
+            point += {step(random), step(random), step(random)};
+        }
+        list.update(points, cutoff_distance, box);
+    }
+    REQUIRE(list.background_rebuild_pending());
+
+    auto copy = list;
+    CHECK_FALSE(copy.background_rebuild_pending());
+
+    md::neighbor_list<md::periodic_box> assigned;
+    assigned = list;
+    CHECK_FALSE(assigned.background_rebuild_pending());
+    CHECK(list.background_rebuild_pending());
+
+    for (auto& point : points) {
+        point += {0.05, 0, 0};
+    }
+    copy.update(points, cutoff_distance, box);
+    list.update(points, cutoff_distance, box);
+
+    std::set<std::pair<md::index, md::index>> expect;
+    for (md::index i = 0; i < points.size(); i++) {
+        for (md::index j = i + 1; j < points.size(); j++) {
+            if (box.shortest_displacement(points[i], points[j]).norm() < cutoff_distance) {
+                expect.emplace(i, j);
+            }
+        }
+    }
+
+    std::set<std::pair<md::index, md::index>> const copy_pairs(copy.begin(), copy.end());
+    std::set<std::pair<md::index, md::index>> const list_pairs(list.begin(), list.end());
+    CHECK(std::includes(copy_pairs.begin(), copy_pairs.end(), expect.begin(), expect.end()));
+    CHECK(std::includes(list_pairs.begin(), list_pairs.end(), expect.begin(), expect.end()));
+}
+
+TEST_CASE("neighbor_list::set_background_rebuild - switches lists with boxes given without hints")
+{
+    md::scalar const cutoff_distance = 0.15;
+    md::index const point_count = 400;
+
+    auto test_on_box = [&](auto box) {
+        using box_type = decltype(box);
+
+        std::mt19937 random;
+        std::uniform_real_distribution<md::scalar> coord;
+        std::normal_distribution<md::scalar> step{0, 0.002};
+
+        std::vector<md::point> points;
+        std::generate_n(std::back_inserter(points), point_count, [&] {
+            return md::point{coord(random), coord(random), coord(random)};
+        });
+
+        md::neighbor_list<box_type> list;
+        list.set_background_rebuild(true);
+
+        for (int round = 0; round < 200; round++) {
+            list.update(points, cutoff_distance, box);
+
+            for (auto& point : points) {
+                point += {step(random), step(random), step(random)};
+            }
+        }
+
+        list.update(points, cutoff_distance, box);
+
+        std::set<std::pair<md::index, md::index>> expect;
+        for (md::index i = 0; i < points.size(); i++) {
+            for (md::index j = i + 1; j < points.size(); j++) {
+                if (box.shortest_displacement(points[i], points[j]).norm() < cutoff_distance) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+        std::set<std::pair<md::index, md::index>> const actual(list.begin(), list.end());
+        CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+
+        CHECK(list.background_switch_count() > 0);
+    };
+
+    SECTION("open_box")
+    {
+        test_on_box(md::open_box{});
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        test_on_box(box);
+    }
+
+    SECTION("z_periodic_box")
+    {
+        md::z_periodic_box box;
+        box.z_period = 1;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_list - finds correct neighbor pairs with per-point radii")
+{
+    md::index const point_count = 1000;
+
+    std::vector<md::point> points;
+    std::vector<md::scalar> radii;
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord;
+    for (md::index i = 0; i < point_count; i++) {
+        points.push_back({coord(random), coord(random), coord(random)});
+        radii.push_back(i % 50 == 0 ? 0.2 : 0.05);
+    }
+
+    auto test_on_box = [&](auto box) {
+        using box_type = decltype(box);
+        md::neighbor_list<box_type> list;
+
+        for (md::index step = 0; step < 3; step++) {
+            // Expect: brute-force.
+            std::set<std::pair<md::index, md::index>> expect;
+
+            for (md::index i = 0; i < points.size(); i++) {
+                for (md::index j = i + 1; j < points.size(); j++) {
+                    md::vector const disp = box.shortest_displacement(points[i], points[j]);
+                    if (disp.norm() < radii[i] + radii[j]) {
+                        expect.emplace(i, j);
+                    }
+                }
+            }
+
+            // Actual: neighbor_list.
+            list.update(points, radii, box);
+
+            std::set<std::pair<md::index, md::index>> actual;
+            for (auto pair : list) {
+                actual.insert(pair);
+            }
+
+            CHECK(std::includes(
+                actual.begin(), actual.end(), expect.begin(), expect.end()
+            ));
+
+            // Small moves keep the list. Radii change forces a rebuild.
+            for (auto& point : points) {
+                point.x += 0.01;
+            }
+            radii[step] = 0.3;
+        }
+    };
+
+    SECTION("in open_box")
+    {
+        md::open_box box;
+        test_on_box(box);
+    }
+
+    SECTION("in periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 0.9;
+        box.y_period = 1.0;
+        box.z_period = 1.1;
+        test_on_box(box);
+    }
+
+    SECTION("in xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 0.9;
+        box.y_period = 1.0;
+        test_on_box(box);
+    }
 }
 
 TEST_CASE("neighbor_list::set_targets - limits list to specified targets")
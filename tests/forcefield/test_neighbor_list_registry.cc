@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <md/basic_types.hpp>
+#include <md/misc/box.hpp>
+#include <md/system.hpp>
+#include <md/potential/constant_potential.hpp>
+#include <md/potential/softcore_potential.hpp>
+
+#include <md/forcefield/neighbor_list_registry.hpp>
+#include <md/forcefield/neighbor_pairwise_forcefield.hpp>
+#include <md/simulation/brownian_dynamics.hpp>
+
+#include <catch.hpp>
+
+
+TEST_CASE("neighbor_list_registry - shares lists among similar cutoff distances")
+{
+    md::index const point_count = 1000;
+
+    std::vector<md::point> points;
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::periodic_box box;
+    box.x_period = 1;
+    box.y_period = 1;
+    box.z_period = 1;
+
+    md::neighbor_list_registry<md::periodic_box> registry{1.5};
+    CHECK(registry.list_count() == 0);
+
+    auto& list1 = registry.update(points, 0.08, box);
+    auto& list2 = registry.update(points, 0.1, box);
+    CHECK(&list1 == &list2);
+    CHECK(registry.list_count() == 1);
+
+    auto& list3 = registry.update(points, 0.2, box);
+    CHECK(&list3 != &list1);
+    CHECK(registry.list_count() == 2);
+
+    // The shared list covers the largest cutoff distance.
+    auto& list = registry.update(points, 0.08, box);
+    CHECK(&list == &list1);
+
+    std::set<std::pair<md::index, md::index>> expect;
+    for (md::index i = 0; i < points.size(); i++) {
+        for (md::index j = i + 1; j < points.size(); j++) {
+            if (box.shortest_displacement(points[i], points[j]).norm() < 0.1) {
+                expect.emplace(i, j);
+            }
+        }
+    }
+
+    std::set<std::pair<md::index, md::index>> const actual(list.begin(), list.end());
+    CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+}
+
+TEST_CASE("neighbor_list_registry::next_step - checks lists once per step")
+{
+    md::index const point_count = 500;
+    md::scalar const dcut = 0.1;
+
+    std::vector<md::point> points;
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::periodic_box box;
+    box.x_period = 1;
+    box.y_period = 1;
+    box.z_period = 1;
+
+    auto neighbor_pairs = [&](md::scalar distance) {
+        std::set<std::pair<md::index, md::index>> pairs;
+        for (md::index i = 0; i < points.size(); i++) {
+            for (md::index j = i + 1; j < points.size(); j++) {
+                if (box.shortest_displacement(points[i], points[j]).norm() < distance) {
+                    pairs.emplace(i, j);
+                }
+            }
+        }
+        return pairs;
+    };
+
+    auto const list_pairs = [](md::neighbor_list<md::periodic_box> const& list) {
+        return std::set<std::pair<md::index, md::index>>(list.begin(), list.end());
+    };
+
+    auto shuffle_points = [&] {
+        std::shuffle(points.begin(), points.end(), random);
+    };
+
+    md::neighbor_list_registry<md::periodic_box> registry;
+    CHECK(registry.step() == 0);
+
+    SECTION("without steps")
+    {
+        // Every request checks the list.
+        registry.update(points, dcut, box);
+        shuffle_points();
+
+        auto const expect = neighbor_pairs(dcut);
+        auto const actual = list_pairs(registry.update(points, dcut, box));
+        CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+    }
+
+    SECTION("with steps")
+    {
+        registry.next_step();
+        CHECK(registry.step() == 1);
+
+        auto const first = list_pairs(registry.update(points, dcut, box));
+
+        // The list is not checked again within a step.
+        shuffle_points();
+        CHECK(list_pairs(registry.update(points, dcut, box)) == first);
+
+        registry.next_step();
+        auto const expect = neighbor_pairs(dcut);
+        auto const actual = list_pairs(registry.update(points, dcut, box));
+        CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+    }
+
+    SECTION("widened cutoff distance")
+    {
+        registry.next_step();
+        registry.update(points, dcut, box);
+
+        // A wider cutoff distance within a step rebuilds the list, which
+        // then keeps covering the widest one.
+        registry.update(points, dcut * 1.2, box);
+        registry.next_step();
+        auto const& list = registry.update(points, dcut, box);
+
+        CHECK(registry.list_count() == 1);
+        auto const expect = neighbor_pairs(dcut * 1.2);
+        auto const actual = list_pairs(list);
+        CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+    }
+}
+
+TEST_CASE("neighbor_pairwise_forcefield::set_neighbor_list_registry - gives the same forcefield")
+{
+    md::index const point_count = 1000;
+
+    md::periodic_box box;
+    box.x_period = 1.0;
+    box.y_period = 1.0;
+    box.z_period = 1.0;
+
+    md::system system;
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    for (md::index i = 0; i < point_count; i++) {
+        auto part = system.add_particle();
+        part.position = {coord(random), coord(random), coord(random)};
+    }
+
+    // Forcefields with cutoff distances 0.1 and 0.12 share a list.
+    auto make_forcefield = [&](md::scalar cutoff_distance) {
+        md::softcore_potential<2, 3> potential;
+        potential.energy = 1.0;
+        potential.diameter = cutoff_distance;
+
+        return md::make_neighbor_pairwise_forcefield<md::periodic_box>(potential)
+            .set_unit_cell(box)
+            .set_neighbor_distance(cutoff_distance);
+    };
+
+    auto registry = std::make_shared<md::neighbor_list_registry<md::periodic_box>>();
+    auto shared1 = make_forcefield(0.1).set_neighbor_list_registry(registry);
+    auto shared2 = make_forcefield(0.12).set_neighbor_list_registry(registry);
+    auto own1 = make_forcefield(0.1);
+    auto own2 = make_forcefield(0.12);
+
+    for (int step = 0; step < 3; step++) {
+        CHECK(shared1.compute_energy(system) == Approx(own1.compute_energy(system)));
+        CHECK(shared2.compute_energy(system) == Approx(own2.compute_energy(system)));
+
+        std::vector<md::vector> expect_forces(system.particle_count());
+        std::vector<md::vector> actual_forces(system.particle_count());
+        own1.compute_force(system, expect_forces);
+        own2.compute_force(system, expect_forces);
+        shared1.compute_force(system, actual_forces);
+        shared2.compute_force(system, actual_forces);
+
+        for (md::index i = 0; i < system.particle_count(); i++) {
+            CHECK(md::norm(actual_forces[i] - expect_forces[i]) == Approx(0).margin(1e-6));
+        }
+
+        for (auto& position : system.view_positions()) {
+            position += {0.01 * coord(random), 0.01 * coord(random), 0.01 * coord(random)};
+        }
+        registry->next_step();
+    }
+
+    CHECK(registry->list_count() == 1);
+}
+
+TEST_CASE("neighbor_pairwise_forcefield::set_neighbor_list_registry - skips pairs beyond cutoff")
+{
+    md::index const point_count = 500;
+    md::scalar const cutoff_distance = 0.1;
+
+    md::periodic_box box;
+    box.x_period = 1.0;
+    box.y_period = 1.0;
+    box.z_period = 1.0;
+
+    md::system system;
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    for (md::index i = 0; i < point_count; i++) {
+        auto part = system.add_particle();
+        part.position = {coord(random), coord(random), coord(random)};
+    }
+
+    // A constant potential counts the pairs the forcefield evaluates.
+    md::constant_potential potential;
+    potential.energy = 1.0;
+
+    auto registry = std::make_shared<md::neighbor_list_registry<md::periodic_box>>();
+    auto forcefield = md::make_neighbor_pairwise_forcefield<md::periodic_box>(potential)
+        .set_unit_cell(box)
+        .set_neighbor_distance(cutoff_distance)
+        .set_neighbor_list_registry(registry);
+
+    md::index pair_count = 0;
+    auto const positions = system.view_positions();
+    for (md::index i = 0; i < point_count; i++) {
+        for (md::index j = i + 1; j < point_count; j++) {
+            if (box.shortest_displacement(positions[i], positions[j]).squared_norm()
+                <= cutoff_distance * cutoff_distance) {
+                pair_count++;
+            }
+        }
+    }
+
+    CHECK(forcefield.compute_energy(system) == Approx(md::scalar(pair_count)));
+}
+
+TEST_CASE("neighbor_list_registry::next_step - works in integrator callback")
+{
+    md::index const point_count = 500;
+
+    md::periodic_box box;
+    box.x_period = 1.0;
+    box.y_period = 1.0;
+    box.z_period = 1.0;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    std::vector<md::point> positions;
+    std::generate_n(std::back_inserter(positions), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    auto make_forcefield = [&](md::scalar cutoff_distance) {
+        md::softcore_potential<2, 3> potential;
+        potential.energy = 1.0;
+        potential.diameter = cutoff_distance;
+
+        return md::make_neighbor_pairwise_forcefield<md::periodic_box>(potential)
+            .set_unit_cell(box)
+            .set_neighbor_distance(cutoff_distance);
+    };
+
+    // The same simulation with shared lists and with own lists.
+    md::system shared_system;
+    md::system own_system;
+    for (auto const& position : positions) {
+        shared_system.add_particle().position = position;
+        own_system.add_particle().position = position;
+    }
+
+    auto registry = std::make_shared<md::neighbor_list_registry<md::periodic_box>>();
+    shared_system.add_forcefield(make_forcefield(0.1).set_neighbor_list_registry(registry));
+    shared_system.add_forcefield(make_forcefield(0.12).set_neighbor_list_registry(registry));
+    own_system.add_forcefield(make_forcefield(0.1));
+    own_system.add_forcefield(make_forcefield(0.12));
+
+    md::brownian_dynamics_config config;
+    config.temperature = 1;
+    config.timestep = 1e-5;
+    config.steps = 50;
+    config.seed = 1;
+
+    md::simulate_brownian_dynamics(own_system, config);
+
+    config.callback = [&](md::step) {
+        registry->next_step();
+    };
+    md::simulate_brownian_dynamics(shared_system, config);
+
+    CHECK(registry->step() == config.steps);
+    CHECK(registry->list_count() == 1);
+
+    auto const shared_positions = shared_system.view_positions();
+    auto const own_positions = own_system.view_positions();
+    for (md::index i = 0; i < point_count; i++) {
+        CHECK(md::distance(shared_positions[i], own_positions[i]) == Approx(0).margin(1e-9));
+    }
+    CHECK(shared_system.compute_potential_energy() == Approx(own_system.compute_potential_energy()));
+}
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cassert>
 #include <iterator>
+#include <random>
 #include <set>
 #include <utility>
 #include <vector>
@@ -93,6 +94,63 @@ TEST_CASE("neighbor_pairwise_forcefield - computes correct forcefield")
     CHECK(max_difference(actual_forces, expect_forces) == Approx(0).margin(0.001));
 }
 
+TEST_CASE("neighbor_pairwise_forcefield::set_neighbor_list_layout - gives the same forcefield")
+{
+    md::scalar const cutoff_distance = 0.2;
+    md::index const point_count = 1000;
+
+    md::periodic_box box;
+    box.x_period = 1.0;
+    box.y_period = 1.0;
+    box.z_period = 1.0;
+
+    md::system system;
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    for (md::index i = 0; i < point_count; i++) {
+        auto part = system.add_particle();
+        part.position = { coord(random), coord(random), coord(random) };
+    }
+
+    md::softcore_potential<2, 3> potential;
+    potential.energy = 1.0;
+    potential.diameter = cutoff_distance;
+
+    auto pair_forcefield = md::make_neighbor_pairwise_forcefield<md::periodic_box>(potential)
+        .set_unit_cell(box)
+        .set_neighbor_distance(cutoff_distance);
+
+    std::vector<md::vector> expect_forces(system.particle_count());
+    pair_forcefield.compute_force(system, expect_forces);
+    md::scalar const expect_energy = pair_forcefield.compute_energy(system);
+
+    auto test_on_layout = [&](md::neighbor_list_layout layout, md::index thread_count) {
+        auto forcefield = md::make_neighbor_pairwise_forcefield<md::periodic_box>(potential)
+            .set_unit_cell(box)
+            .set_neighbor_distance(cutoff_distance)
+            .set_neighbor_list_layout(layout)
+            .set_thread_count(thread_count);
+
+        std::vector<md::vector> actual_forces(system.particle_count());
+        forcefield.compute_force(system, actual_forces);
+
+        CHECK(forcefield.compute_energy(system) == Approx(expect_energy));
+        CHECK(max_difference(actual_forces, expect_forces) == Approx(0).margin(1e-6));
+    };
+
+    SECTION("csr")
+    {
+        test_on_layout(md::neighbor_list_layout::csr, 1);
+        test_on_layout(md::neighbor_list_layout::csr, 4);
+    }
+
+    SECTION("full")
+    {
+        test_on_layout(md::neighbor_list_layout::full, 1);
+        test_on_layout(md::neighbor_list_layout::full, 4);
+    }
+}
+
 TEST_CASE("neighbor_pairwise_forcefield::set_neighbor_targets - limits search targets")
 {
     md::scalar const cutoff_distance = 0.1;
@@ -152,6 +210,58 @@ TEST_CASE("neighbor_pairwise_forcefield::set_neighbor_targets - limits search ta
     CHECK(actual_energy == Approx(expect_energy));
 }
 
+TEST_CASE("neighbor_pairwise_forcefield::set_neighbor_radius - uses per-particle cutoff")
+{
+    md::index const point_count = 500;
+
+    md::periodic_box box;
+    box.x_period = 1.0;
+    box.y_period = 1.0;
+    box.z_period = 1.0;
+
+    md::attribute_key<md::scalar, struct radius_key> radius_attribute = {};
+
+    // Mixture of a few large particles and many small ones.
+    md::system system;
+    system.add_attribute(radius_attribute);
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    for (md::index i = 0; i < point_count; i++) {
+        auto part = system.add_particle();
+        part.position = {coord(random), coord(random), coord(random)};
+        part.view(radius_attribute) = (i % 50 == 0 ? 0.15 : 0.03);
+    }
+
+    md::array_view<md::point const> positions = system.view_positions();
+    md::array_view<md::scalar const> radii = system.view(radius_attribute);
+
+    auto potential = [&](md::index i, md::index j) {
+        md::softcore_potential<2, 3> pot;
+        pot.energy = 1.0;
+        pot.diameter = radii[i] + radii[j];
+        return pot;
+    };
+
+    auto forcefield = md::make_neighbor_pairwise_forcefield<md::periodic_box>(potential)
+        .set_unit_cell(box)
+        .set_neighbor_radius(radius_attribute);
+
+    md::scalar expect_energy = 0;
+
+    for (md::index i = 0; i < positions.size(); i++) {
+        for (md::index j = i + 1; j < positions.size(); j++) {
+            md::vector const r = box.shortest_displacement(positions[i], positions[j]);
+            if (r.norm() < radii[i] + radii[j]) {
+                expect_energy += potential(i, j).evaluate_energy(r);
+            }
+        }
+    }
+
+    CHECK(expect_energy > 0);
+    CHECK(forcefield.compute_energy(system) == Approx(expect_energy));
+}
+
 TEST_CASE("neighbor_pairwise_forcefield::set_unit_cell - changes unit cell")
 {
     md::scalar const cutoff_distance = 0.1;
@@ -0,0 +1,73 @@
+#include <cstdint>
+#include <vector>
+
+#include <md/misc/nsearch_detail/cell_table.hpp>
+
+#include <catch.hpp>
+
+
+TEST_CASE("cell_table - assigns consecutive buckets to distinct cells")
+{
+    using md::nsearch_detail::cell_table;
+
+    cell_table table;
+    CHECK(table.size() == 0);
+    CHECK(table.find(cell_table::make_key(0, 0, 0)) == md::nsearch_detail::no_bucket);
+
+    // Enough cells to trigger rehashing several times.
+    std::vector<std::uint64_t> keys;
+    for (std::int64_t z = -5; z < 5; z++) {
+        for (std::int64_t y = -5; y < 5; y++) {
+            for (std::int64_t x = -5; x < 5; x++) {
+                keys.push_back(cell_table::make_key(x, y, z));
+            }
+        }
+    }
+
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        CHECK(table.insert(keys[i]) == i);
+    }
+    CHECK(table.size() == keys.size());
+
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        CHECK(table.find(keys[i]) == i);
+        CHECK(table.key(i) == keys[i]);
+    }
+    CHECK(table.find(cell_table::make_key(5, 0, 0)) == md::nsearch_detail::no_bucket);
+
+    table.clear();
+    CHECK(table.size() == 0);
+    CHECK(table.find(keys[0]) == md::nsearch_detail::no_bucket);
+}
+
+TEST_CASE("cell_table::shift_key - wraps around consistently")
+{
+    using md::nsearch_detail::cell_table;
+
+    auto const key = cell_table::make_key(-1, 0, 1);
+    CHECK(cell_table::shift_key(key, 1, 0, -1) == cell_table::make_key(0, 0, 0));
+    CHECK(cell_table::shift_key(key, -1, -1, -1) == cell_table::make_key(-2, -1, 0));
+
+    // Coordinates wrap around modulo 2^21.
+    std::int64_t const period = std::int64_t(1) << 21;
+    CHECK(cell_table::make_key(period - 1, 0, 0) == cell_table::make_key(-1, 0, 0));
+    CHECK(cell_table::shift_key(cell_table::make_key(period - 1, 0, 0), 1, 0, 0) == cell_table::make_key(0, 0, 0));
+
+    // Shifting is done per field, never carrying into the other fields.
+    std::int64_t const limit = period / 2;
+    auto const edge_key = cell_table::make_key(-limit, limit - 1, -limit);
+    CHECK(cell_table::shift_key(edge_key, -1, 1, 0) == cell_table::make_key(limit - 1, -limit, -limit));
+    CHECK(cell_table::shift_key(edge_key, 3, -3, 2) == cell_table::make_key(-limit + 3, limit - 4, -limit + 2));
+}
+
+TEST_CASE("cell_table::in_range - accepts coordinates with distinct keys")
+{
+    using md::nsearch_detail::cell_table;
+
+    std::int64_t const limit = std::int64_t(1) << 20;
+    CHECK(cell_table::in_range(0, 0, 0));
+    CHECK(cell_table::in_range(-limit, limit - 1, 0));
+    CHECK_FALSE(cell_table::in_range(limit, 0, 0));
+    CHECK_FALSE(cell_table::in_range(0, -limit - 1, 0));
+    CHECK_FALSE(cell_table::in_range(0, 0, std::int64_t(1) << 40));
+}
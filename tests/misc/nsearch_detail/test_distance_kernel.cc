@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include <md/basic_types.hpp>
+#include <md/misc/box.hpp>
+#include <md/misc/nsearch_detail/distance_kernel.hpp>
+
+#include <catch.hpp>
+
+
+TEST_CASE("filter_within - finds points within cutoff distance")
+{
+    md::index const point_count = 1001;
+    md::scalar const dcut = 0.7;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{-2, 2};
+    std::vector<md::scalar> xs;
+    std::vector<md::scalar> ys;
+    std::vector<md::scalar> zs;
+    std::generate_n(std::back_inserter(xs), point_count, [&] { return coord(random); });
+    std::generate_n(std::back_inserter(ys), point_count, [&] { return coord(random); });
+    std::generate_n(std::back_inserter(zs), point_count, [&] { return coord(random); });
+
+    auto test_on_box = [&](auto box) {
+        using box_type = decltype(box);
+
+        md::point const center = {0.1, -0.2, 0.3};
+        auto const filter = md::nsearch_detail::make_distance_filter(box, center, dcut * dcut);
+
+        // Ground truth. Test a range that is not aligned to SIMD width.
+        md::index const begin = 3;
+        md::index const end = point_count;
+        std::vector<std::uint32_t> expect;
+
+        for (md::index i = begin; i < end; i++) {
+            md::point const point = {xs[i], ys[i], zs[i]};
+            if (box.shortest_displacement(point, center).squared_norm() <= dcut * dcut) {
+                expect.push_back(std::uint32_t(i));
+            }
+        }
+        CHECK_FALSE(expect.empty());
+
+        std::vector<std::uint32_t> scalar_hits(end - begin);
+        scalar_hits.resize(md::nsearch_detail::filter_within_scalar<box_type>(
+            filter, xs.data(), ys.data(), zs.data(), begin, end, scalar_hits.data()
+        ));
+        CHECK(scalar_hits == expect);
+
+        std::vector<std::uint32_t> hits(end - begin);
+        hits.resize(md::nsearch_detail::filter_within<box_type>(
+            filter, xs.data(), ys.data(), zs.data(), begin, end, hits.data()
+        ));
+        CHECK(hits == expect);
+    };
+
+    SECTION("open_box")
+    {
+        test_on_box(md::open_box{});
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 0.9;
+        box.y_period = 1.0;
+        box.z_period = 1.1;
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 0.9;
+        box.y_period = 1.1;
+        test_on_box(box);
+    }
+}
@@ -17,6 +17,14 @@ TEST_CASE("xy_periodic_box - has reasonable defaults for hint parameters")
     CHECK(box.particle_count > 0);
 }
 
+TEST_CASE("axis_periodic_box - has reasonable defaults for hint parameters")
+{
+    md::z_periodic_box box;
+    CHECK(box.x_span > 0);
+    CHECK(box.y_span > 0);
+    CHECK(box.particle_count > 0);
+}
+
 TEST_CASE("open_box - computes correct displacement")
 {
     md::open_box box;
@@ -88,3 +96,54 @@ TEST_CASE("xy_periodic_box - computes correct displacement")
         CHECK(actual.z == Approx(expected.z));
     }
 }
+
+TEST_CASE("axis_periodic_box - computes correct displacement")
+{
+    md::point const p1 = {0.1, 0.2, 0.3};
+    md::point const p2 = {0.9, 1.9, 2.9};
+
+    SECTION("z_periodic_box")
+    {
+        md::z_periodic_box box;
+        box.z_period = 3;
+
+        md::vector const expected = {-0.8, -1.7, 0.4};
+        md::vector const actual = box.shortest_displacement(p1, p2);
+        CHECK(actual.x == Approx(expected.x));
+        CHECK(actual.y == Approx(expected.y));
+        CHECK(actual.z == Approx(expected.z));
+    }
+
+    SECTION("xz-periodic box")
+    {
+        md::axis_periodic_box<md::periodic_x | md::periodic_z> box;
+        box.x_period = 1;
+        box.y_period = 2;
+        box.z_period = 3;
+
+        md::vector const expected = {0.2, -1.7, 0.4};
+        md::vector const actual = box.shortest_displacement(p1, p2);
+        CHECK(actual.x == Approx(expected.x));
+        CHECK(actual.y == Approx(expected.y));
+        CHECK(actual.z == Approx(expected.z));
+    }
+
+    SECTION("same as periodic_box with all axes periodic")
+    {
+        md::axis_periodic_box<md::periodic_x | md::periodic_y | md::periodic_z> box;
+        box.x_period = 1;
+        box.y_period = 2;
+        box.z_period = 3;
+
+        md::periodic_box periodic;
+        periodic.x_period = 1;
+        periodic.y_period = 2;
+        periodic.z_period = 3;
+
+        md::vector const expected = periodic.shortest_displacement(p1, p2);
+        md::vector const actual = box.shortest_displacement(p1, p2);
+        CHECK(actual.x == Approx(expected.x));
+        CHECK(actual.y == Approx(expected.y));
+        CHECK(actual.z == Approx(expected.z));
+    }
+}
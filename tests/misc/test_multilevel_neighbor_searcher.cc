@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <md/misc/box.hpp>
+#include <md/misc/multilevel_neighbor_searcher.hpp>
+
+#include <catch.hpp>
+
+
+namespace
+{
+    // Returns true if the multiset contains the same values of the other set.
+    template<typename T>
+    bool equal(std::multiset<T> const& set1, std::set<T> const& set2)
+    {
+        return std::equal(set1.begin(), set1.end(), set2.begin(), set2.end());
+    }
+}
+
+TEST_CASE("multilevel_neighbor_searcher - outputs nothing by default")
+{
+    md::multilevel_neighbor_searcher<md::open_box> searcher{md::open_box{}};
+    std::vector<std::pair<md::index, md::index>> pairs;
+    searcher.search(std::back_inserter(pairs));
+    CHECK(pairs.empty());
+    CHECK(searcher.level_count() == 0);
+}
+
+TEST_CASE("multilevel_neighbor_searcher - finds pairs within the sum of radii")
+{
+    md::index const point_count = 1500;
+
+    // Mixture of many small points and a few large ones.
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    std::vector<md::point> points;
+    std::vector<md::scalar> radii;
+
+    for (md::index i = 0; i < point_count; i++) {
+        points.push_back({coord(random), coord(random), coord(random)});
+        radii.push_back(i % 100 == 0 ? 0.1 : i % 10 == 0 ? 0.05 : 0.02 + 0.01 * coord(random));
+    }
+
+    auto test_on_margin = [&](auto box, md::scalar margin) {
+        std::set<std::pair<md::index, md::index>> expect;
+
+        for (md::index j = 0; j < points.size(); j++) {
+            for (md::index i = 0; i < j; i++) {
+                md::vector const disp = box.shortest_displacement(points[i], points[j]);
+                if (disp.norm() <= radii[i] + radii[j] + margin) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+
+        using box_type = decltype(box);
+        md::multilevel_neighbor_searcher<box_type> searcher{box, margin};
+        searcher.set_points(points, radii);
+        CHECK(searcher.level_count() == 3);
+
+        std::multiset<std::pair<md::index, md::index>> actual;
+        searcher.search(std::inserter(actual, actual.end()));
+        CHECK(equal(actual, expect));
+
+        // Reuses grids.
+        for (auto& point : points) {
+            point.x += 0.01;
+        }
+        searcher.set_points(points, radii);
+
+        expect.clear();
+        for (md::index j = 0; j < points.size(); j++) {
+            for (md::index i = 0; i < j; i++) {
+                md::vector const disp = box.shortest_displacement(points[i], points[j]);
+                if (disp.norm() <= radii[i] + radii[j] + margin) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+
+        actual.clear();
+        searcher.search(std::inserter(actual, actual.end()));
+        CHECK(equal(actual, expect));
+    };
+
+    auto test_on_box = [&](auto box) {
+        test_on_margin(box, 0);
+        test_on_margin(box, 0.02);
+    };
+
+    SECTION("open_box")
+    {
+        md::open_box box;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_period = 1;
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_span = 1;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+}
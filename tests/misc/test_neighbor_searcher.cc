@@ -1,5 +1,7 @@
 #include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <iterator>
 #include <random>
 #include <set>
@@ -28,9 +30,11 @@ TEST_CASE("neighbor_searcher - is instantiable with standard boxes")
     using open_searcher = md::neighbor_searcher<md::open_box>;
     using periodic_searcher = md::neighbor_searcher<md::periodic_box>;
     using xy_periodic_searcher = md::neighbor_searcher<md::xy_periodic_box>;
+    using z_periodic_searcher = md::neighbor_searcher<md::z_periodic_box>;
     CHECK(sizeof(open_searcher) > 0);
     CHECK(sizeof(periodic_searcher) > 0);
     CHECK(sizeof(xy_periodic_searcher) > 0);
+    CHECK(sizeof(z_periodic_searcher) > 0);
 }
 
 TEST_CASE("neighbor_searcher - outputs nothing by default")
@@ -124,6 +128,28 @@ TEST_CASE("neighbor_searcher - finds correct neighbors in point cloud")
         auto const result = compute_actual_expect(box);
         CHECK(equal(result.actual, result.expect));
     }
+
+    SECTION("z_periodic_box")
+    {
+        md::z_periodic_box box;
+        box.z_period = 1.1;
+        box.x_span = 1.0;
+        box.y_span = 1.0;
+        box.particle_count = point_count;
+        auto const result = compute_actual_expect(box);
+        CHECK(equal(result.actual, result.expect));
+    }
+
+    SECTION("xz-periodic box")
+    {
+        md::axis_periodic_box<md::periodic_x | md::periodic_z> box;
+        box.x_period = 0.9;
+        box.z_period = 1.1;
+        box.y_span = 1.0;
+        box.particle_count = point_count;
+        auto const result = compute_actual_expect(box);
+        CHECK(equal(result.actual, result.expect));
+    }
 }
 
 TEST_CASE("neighbor_searcher - finds correct neighbors of query point")
@@ -198,3 +224,1279 @@ TEST_CASE("neighbor_searcher - finds correct neighbors of query point")
         CHECK(equal(result.actual, result.expect));
     }
 }
+
+TEST_CASE("neighbor_searcher - parallel search gives the same pairs as serial search")
+{
+    md::index const point_count = 1000;
+    md::scalar const neighbor_distance = 0.15;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{-1, 1};
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    auto test_on_box = [&](auto box) {
+        using box_type = decltype(box);
+        md::neighbor_searcher<box_type> searcher{box, neighbor_distance};
+        searcher.set_points(points);
+
+        std::vector<std::pair<md::index, md::index>> expect;
+        searcher.search(std::back_inserter(expect));
+        CHECK_FALSE(expect.empty());
+
+        for (md::index thread_count = 1; thread_count <= 5; thread_count++) {
+            std::vector<std::pair<md::index, md::index>> actual;
+            searcher.search(std::back_inserter(actual), thread_count);
+            CHECK(actual == expect);
+        }
+    };
+
+    SECTION("open_box")
+    {
+        md::open_box box;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1.9;
+        box.y_period = 2.0;
+        box.z_period = 2.1;
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1.9;
+        box.y_period = 2.1;
+        box.z_span = 2.0;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_searcher::update_points - gives the same pairs as set_points")
+{
+    md::index const point_count = 1000;
+    md::scalar const neighbor_distance = 0.15;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{-1, 1};
+    std::normal_distribution<md::scalar> step{0, 0.01};
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    auto test_on_box = [&](auto box) {
+        using box_type = decltype(box);
+        using pair_set = std::set<std::pair<md::index, md::index>>;
+
+        md::neighbor_searcher<box_type> searcher{box, neighbor_distance};
+
+        for (int iter = 0; iter < 20; iter++) {
+            // Small steps move a few points across buckets. Occasional large
+            // steps force fallback to full rebuild.
+            md::scalar const scale = (iter % 7 == 6) ? 10 : 1;
+            for (auto& point : points) {
+                point += scale * md::vector{step(random), step(random), step(random)};
+            }
+
+            searcher.update_points(points);
+
+            pair_set actual;
+            searcher.search(std::inserter(actual, actual.end()));
+
+            md::neighbor_searcher<box_type> fresh_searcher{box, neighbor_distance};
+            fresh_searcher.set_points(points);
+
+            pair_set expect;
+            fresh_searcher.search(std::inserter(expect, expect.end()));
+
+            CHECK(actual == expect);
+        }
+    };
+
+    SECTION("open_box")
+    {
+        md::open_box box;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1.9;
+        box.y_period = 2.0;
+        box.z_period = 2.1;
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1.9;
+        box.y_period = 2.1;
+        box.z_span = 2.0;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+
+    SECTION("z_periodic_box")
+    {
+        md::z_periodic_box box;
+        box.z_period = 2.1;
+        box.x_span = 2.0;
+        box.y_span = 2.0;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_searcher - batch query gives the same neighbors as single queries")
+{
+    md::index const point_count = 1000;
+    md::index const probe_count = 300;
+    md::scalar const neighbor_distance = 0.2;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{-1, 1};
+    std::vector<md::point> points;
+    std::vector<md::point> probes;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+    std::generate_n(std::back_inserter(probes), probe_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    auto test_on_box = [&](auto box) {
+        using box_type = decltype(box);
+        md::neighbor_searcher<box_type> searcher{box, neighbor_distance};
+        searcher.set_points(points);
+
+        for (md::index thread_count = 1; thread_count <= 3; thread_count++) {
+            std::vector<md::index> offsets;
+            std::vector<md::index> neighbors;
+            searcher.query(probes, offsets, neighbors, thread_count);
+
+            REQUIRE(offsets.size() == probe_count + 1);
+            CHECK(offsets.front() == 0);
+            CHECK(offsets.back() == neighbors.size());
+
+            for (md::index k = 0; k < probe_count; k++) {
+                std::vector<md::index> expect;
+                searcher.query(probes[k], std::back_inserter(expect));
+
+                std::vector<md::index> const actual(
+                    neighbors.begin() + std::ptrdiff_t(offsets[k]),
+                    neighbors.begin() + std::ptrdiff_t(offsets[k + 1])
+                );
+                CHECK(actual == expect);
+            }
+        }
+    };
+
+    SECTION("open_box")
+    {
+        md::open_box box;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1.9;
+        box.y_period = 2.0;
+        box.z_period = 2.1;
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1.9;
+        box.y_period = 2.1;
+        box.z_span = 2.0;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_searcher::knn - finds k nearest neighbors")
+{
+    md::index const point_count = 500;
+    md::scalar const neighbor_distance = 0.2;
+
+    std::mt19937 random;
+    std::normal_distribution<md::scalar> coord;
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    // Ground truth by sorting all points by distance.
+    auto brute_force_knn = [&](auto box, md::point center, md::index k, md::index excluded) {
+        std::vector<std::pair<md::scalar, md::index>> candidates;
+        for (md::index i = 0; i < points.size(); i++) {
+            if (i != excluded) {
+                auto const disp = box.shortest_displacement(points[i], center);
+                candidates.emplace_back(disp.squared_norm(), i);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        std::vector<md::index> indices;
+        for (md::index rank = 0; rank < std::min(k, candidates.size()); rank++) {
+            indices.push_back(candidates[rank].second);
+        }
+        return indices;
+    };
+
+    auto test_on_box = [&](auto box, md::neighbor_search_options options = {}) {
+        using box_type = decltype(box);
+        md::neighbor_searcher<box_type> searcher{box, neighbor_distance, options};
+        searcher.set_points(points);
+
+        // Query points inside and far outside the point cloud.
+        std::vector<md::point> const centers = {
+            {0.0, 0.0, 0.0},
+            {0.3, -0.5, 1.2},
+            {5.0, 5.0, -5.0},
+            {300.0, -200.0, 100.0}
+        };
+
+        for (auto const center : centers) {
+            for (md::index const k : {1u, 5u, 30u, 600u}) {
+                std::vector<md::index> actual;
+                searcher.knn(center, k, std::back_inserter(actual));
+                CHECK(actual == brute_force_knn(box, center, k, point_count));
+            }
+        }
+
+        for (md::index const k : {1u, 4u}) {
+            std::vector<md::index> neighbors;
+            auto const m = searcher.knn_all(k, neighbors, 3);
+            REQUIRE(m == k);
+            REQUIRE(neighbors.size() == point_count * k);
+
+            for (md::index i = 0; i < point_count; i++) {
+                std::vector<md::index> const actual(
+                    neighbors.begin() + std::ptrdiff_t(i * k),
+                    neighbors.begin() + std::ptrdiff_t(i * k + k)
+                );
+                CHECK(actual == brute_force_knn(box, points[i], k, i));
+            }
+        }
+    };
+
+    SECTION("open_box")
+    {
+        md::open_box box;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+
+    SECTION("open_box with exact hash")
+    {
+        md::neighbor_search_options options;
+        options.open_grid = md::open_grid_policy::exact_hash;
+
+        md::open_box box;
+        box.particle_count = point_count;
+        test_on_box(box, options);
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1.9;
+        box.y_period = 2.0;
+        box.z_period = 2.1;
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1.9;
+        box.y_period = 2.1;
+        box.z_span = 2.0;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_searcher - finds correct neighbors in compact and sparse open systems")
+{
+    md::scalar const neighbor_distance = 0.1;
+
+    auto test_on_points = [&](std::vector<md::point> const& points) {
+        std::set<std::pair<md::index, md::index>> expect;
+
+        for (md::index j = 0; j < points.size(); j++) {
+            for (md::index i = 0; i < j; i++) {
+                if (md::distance(points[i], points[j]) <= neighbor_distance) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+
+        md::open_box box;
+        box.particle_count = points.size();
+
+        md::open_grid_policy const policies[] = {
+            md::open_grid_policy::adaptive,
+            md::open_grid_policy::exact_hash,
+        };
+
+        for (auto const policy : policies) {
+            md::neighbor_search_options options;
+            options.open_grid = policy;
+            md::neighbor_searcher<md::open_box> searcher{box, neighbor_distance, options};
+
+            // Move the point cloud around to exercise refitting.
+            std::vector<md::point> moved_points = points;
+
+            for (int iter = 0; iter < 3; iter++) {
+                searcher.update_points(moved_points);
+
+                std::multiset<std::pair<md::index, md::index>> actual;
+                searcher.search(std::inserter(actual, actual.end()));
+                CHECK(equal(actual, expect));
+
+                // Query around a point and an empty spot.
+                for (md::index probe_index : {md::index(0), points.size() - 1}) {
+                    auto const probe = moved_points[probe_index] + md::vector{0.05, 0, 0};
+
+                    std::set<md::index> expect_query;
+                    for (md::index i = 0; i < points.size(); i++) {
+                        if (md::distance(probe, moved_points[i]) < neighbor_distance) {
+                            expect_query.insert(i);
+                        }
+                    }
+
+                    std::multiset<md::index> actual_query;
+                    searcher.query(probe, std::inserter(actual_query, actual_query.end()));
+                    CHECK(equal(actual_query, expect_query));
+                }
+
+                for (auto& point : moved_points) {
+                    point += md::vector{0.3, -0.2, 0.1};
+                }
+            }
+        }
+    };
+
+    std::mt19937 random;
+
+    SECTION("dense droplet")
+    {
+        std::uniform_real_distribution<md::scalar> coord{-0.5, 0.5};
+        std::vector<md::point> points;
+        while (points.size() < 2000) {
+            md::point const point = {coord(random), coord(random), coord(random)};
+            if (md::distance(point, md::point{}) < 0.5) {
+                points.push_back(point);
+            }
+        }
+        test_on_points(points);
+    }
+
+    SECTION("droplet with distant particles")
+    {
+        std::uniform_real_distribution<md::scalar> coord{-0.5, 0.5};
+        std::vector<md::point> points;
+        std::generate_n(std::back_inserter(points), 1000, [&] {
+            return md::point{coord(random), coord(random), coord(random)};
+        });
+        points.push_back({100, 0, 0});
+        points.push_back({100.05, 0, 0});
+        points.push_back({-30, 40, -50});
+        test_on_points(points);
+    }
+
+    SECTION("clusters farther apart than the range of exact cell keys")
+    {
+        // 2^21 cells of the cutoff distance apart, so that the cell keys of
+        // the two clusters would alias.
+        md::scalar const offset = neighbor_distance * (1 << 21);
+        std::uniform_real_distribution<md::scalar> coord{-0.5, 0.5};
+        std::vector<md::point> points;
+        std::generate_n(std::back_inserter(points), 500, [&] {
+            return md::point{coord(random), coord(random), coord(random)};
+        });
+        std::generate_n(std::back_inserter(points), 500, [&] {
+            return md::point{offset + coord(random), coord(random), -offset + coord(random)};
+        });
+        test_on_points(points);
+    }
+
+    SECTION("dilute gas")
+    {
+        std::uniform_real_distribution<md::scalar> coord{-10, 10};
+        std::vector<md::point> points;
+        std::generate_n(std::back_inserter(points), 1000, [&] {
+            return md::point{coord(random), coord(random), coord(random)};
+        });
+        test_on_points(points);
+    }
+}
+
+TEST_CASE("neighbor_searcher - subdivided grid finds the same neighbors")
+{
+    md::index const point_count = 2000;
+    md::scalar const neighbor_distance = 0.15;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    auto test_on_box = [&](auto box) {
+        std::set<std::pair<md::index, md::index>> expect;
+
+        for (md::index j = 0; j < points.size(); j++) {
+            for (md::index i = 0; i < j; i++) {
+                md::vector const disp = box.shortest_displacement(points[i], points[j]);
+                if (disp.norm() <= neighbor_distance) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+
+        md::point const probe = {0.5, 0.05, 0.95};
+        std::set<md::index> expect_query;
+
+        for (md::index i = 0; i < points.size(); i++) {
+            if (box.shortest_displacement(probe, points[i]).norm() < neighbor_distance) {
+                expect_query.insert(i);
+            }
+        }
+
+        for (std::uint32_t subdivision : {1u, 2u, 3u}) {
+            md::neighbor_search_options options;
+            options.subdivision = subdivision;
+
+            using box_type = decltype(box);
+            md::neighbor_searcher<box_type> searcher{box, neighbor_distance, options};
+            searcher.set_points(points);
+
+            std::multiset<std::pair<md::index, md::index>> actual;
+            searcher.search(std::inserter(actual, actual.end()));
+            CHECK(equal(actual, expect));
+
+            std::multiset<md::index> actual_query;
+            searcher.query(probe, std::inserter(actual_query, actual_query.end()));
+            CHECK(equal(actual_query, expect_query));
+        }
+    };
+
+    SECTION("open_box")
+    {
+        md::open_box box;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_period = 1;
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_span = 1;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_searcher - compact members give the same results")
+{
+    md::index const point_count = 1500;
+    md::scalar const neighbor_distance = 0.15;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    std::normal_distribution<md::scalar> step{0, 0.02};
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    // Make some pairs lie right on the cutoff distance.
+    for (md::index i = 0; i < 20; i++) {
+        points[i + 20] = points[i] + md::vector{neighbor_distance, 0, 0};
+    }
+
+    auto test_on_box = [&](auto box) {
+        using box_type = decltype(box);
+
+        md::neighbor_search_options options;
+        options.compact_members = true;
+
+        md::neighbor_searcher<box_type> exact_searcher{box, neighbor_distance};
+        md::neighbor_searcher<box_type> compact_searcher{box, neighbor_distance, options};
+
+        auto moved_points = points;
+
+        for (int iter = 0; iter < 4; iter++) {
+            exact_searcher.update_points(moved_points);
+            compact_searcher.update_points(moved_points);
+
+            std::vector<std::pair<md::index, md::index>> expect;
+            std::vector<std::pair<md::index, md::index>> actual;
+            exact_searcher.search(std::back_inserter(expect));
+            compact_searcher.search(std::back_inserter(actual));
+            std::sort(expect.begin(), expect.end());
+            std::sort(actual.begin(), actual.end());
+            CHECK(actual == expect);
+
+            std::vector<md::index> expect_knn;
+            std::vector<md::index> actual_knn;
+            exact_searcher.knn(moved_points[0], 10, std::back_inserter(expect_knn));
+            compact_searcher.knn(moved_points[0], 10, std::back_inserter(actual_knn));
+            CHECK(actual_knn == expect_knn);
+
+            for (auto& point : moved_points) {
+                point += md::vector{step(random), step(random), step(random)};
+            }
+        }
+    };
+
+    SECTION("open_box")
+    {
+        md::open_box box;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_period = 1;
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_span = 1;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_searcher - pruned and sorted buckets give the same pairs")
+{
+    md::index const point_count = 1500;
+    md::scalar const neighbor_distance = 0.15;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    std::normal_distribution<md::scalar> step{0, 0.02};
+
+    auto test_on_box = [&](auto box, md::scalar span) {
+        // Points may lie outside the periodic box.
+        std::vector<md::point> points;
+        std::generate_n(std::back_inserter(points), point_count, [&] {
+            return md::point{
+                span * (3 * coord(random) - 1),
+                span * (3 * coord(random) - 1),
+                span * coord(random)
+            };
+        });
+
+        auto brute_force = [&] {
+            std::set<std::pair<md::index, md::index>> pairs;
+            for (md::index j = 0; j < points.size(); j++) {
+                for (md::index i = 0; i < j; i++) {
+                    md::vector const disp = box.shortest_displacement(points[i], points[j]);
+                    if (disp.squared_norm() <= neighbor_distance * neighbor_distance) {
+                        pairs.emplace(i, j);
+                    }
+                }
+            }
+            return pairs;
+        };
+
+        using box_type = decltype(box);
+
+        for (std::uint32_t subdivision : {1u, 2u}) {
+            md::neighbor_search_options default_options;
+            default_options.subdivision = subdivision;
+
+            md::neighbor_search_options pruned_options = default_options;
+            pruned_options.prune_buckets = true;
+
+            md::neighbor_search_options sorted_options = default_options;
+            sorted_options.sort_members = true;
+
+            md::neighbor_search_options both_options = pruned_options;
+            both_options.sort_members = true;
+
+            md::neighbor_searcher<box_type> reference{box, neighbor_distance, default_options};
+            std::vector<md::neighbor_searcher<box_type>> searchers = {
+                {box, neighbor_distance, pruned_options},
+                {box, neighbor_distance, sorted_options},
+                {box, neighbor_distance, both_options},
+            };
+
+            reference.set_points(points);
+            for (auto& searcher : searchers) {
+                searcher.set_points(points);
+            }
+
+            for (int round = 0; round < 3; round++) {
+                auto const expect = brute_force();
+
+                md::neighbor_search_stats reference_stats;
+                std::multiset<std::pair<md::index, md::index>> reference_pairs;
+                reference.search(std::inserter(reference_pairs, reference_pairs.end()), reference_stats);
+                CHECK(equal(reference_pairs, expect));
+                CHECK(reference_stats.pairs == expect.size());
+                CHECK(reference_stats.distance_evaluations >= reference_stats.pairs);
+
+                for (auto const& searcher : searchers) {
+                    md::neighbor_search_stats stats;
+                    std::multiset<std::pair<md::index, md::index>> actual;
+                    searcher.search(std::inserter(actual, actual.end()), stats);
+                    CHECK(equal(actual, expect));
+                    CHECK(stats.pairs == expect.size());
+                    CHECK(stats.distance_evaluations >= stats.pairs);
+                    CHECK(stats.distance_evaluations <= reference_stats.distance_evaluations);
+                }
+
+                for (auto& point : points) {
+                    point += {step(random), step(random), step(random)};
+                }
+                reference.update_points(points);
+                for (auto& searcher : searchers) {
+                    searcher.update_points(points);
+                }
+            }
+        }
+    };
+
+    SECTION("open_box")
+    {
+        md::open_box box;
+        box.particle_count = point_count;
+        test_on_box(box, 1);
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_period = 1;
+        test_on_box(box, 1);
+    }
+
+    SECTION("small periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 0.5;
+        box.y_period = 0.5;
+        box.z_period = 0.5;
+        test_on_box(box, 0.5);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_span = 1;
+        box.particle_count = point_count;
+        test_on_box(box, 1);
+    }
+
+    SECTION("z_periodic_box")
+    {
+        md::z_periodic_box box;
+        box.z_period = 1;
+        box.x_span = 3;
+        box.y_span = 3;
+        box.particle_count = point_count;
+        test_on_box(box, 1);
+    }
+}
+
+TEST_CASE("neighbor_searcher - adaptive bins give the same results in phase-separated system")
+{
+    md::index const point_count = 2000;
+    md::scalar const neighbor_distance = 0.05;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    std::normal_distribution<md::scalar> step{0, 0.005};
+
+    // Dense slab in dilute gas. The slab moves along z and spreads out.
+    std::vector<md::point> points;
+    for (md::index i = 0; i < point_count; i++) {
+        auto const z = i % 10 == 0 ? coord(random) : 0.4 + 0.1 * coord(random);
+        points.push_back({coord(random), coord(random), z});
+    }
+
+    auto test_on_box = [&](auto box) {
+        using box_type = decltype(box);
+
+        auto brute_force = [&] {
+            std::set<std::pair<md::index, md::index>> pairs;
+            for (md::index j = 0; j < points.size(); j++) {
+                for (md::index i = 0; i < j; i++) {
+                    md::vector const disp = box.shortest_displacement(points[i], points[j]);
+                    if (disp.squared_norm() <= neighbor_distance * neighbor_distance) {
+                        pairs.emplace(i, j);
+                    }
+                }
+            }
+            return pairs;
+        };
+
+        for (std::uint32_t subdivision : {1u, 2u}) {
+            md::neighbor_search_options options;
+            options.subdivision = subdivision;
+            options.adaptive_bins = true;
+
+            md::neighbor_searcher<box_type> searcher{box, neighbor_distance, options};
+            searcher.set_points(points);
+
+            for (int round = 0; round < 4; round++) {
+                auto const expect = brute_force();
+
+                std::multiset<std::pair<md::index, md::index>> actual;
+                searcher.search(std::inserter(actual, actual.end()));
+                CHECK(equal(actual, expect));
+
+                // Query and knn around the slab and in the gas.
+                for (auto const center : {md::point{0.5, 0.5, 0.45}, md::point{0.1, 0.9, 0.9}}) {
+                    std::set<md::index> expect_neighbors;
+                    std::vector<std::pair<md::scalar, md::index>> ranked;
+                    for (md::index i = 0; i < points.size(); i++) {
+                        md::vector const disp = box.shortest_displacement(points[i], center);
+                        if (disp.squared_norm() <= neighbor_distance * neighbor_distance) {
+                            expect_neighbors.insert(i);
+                        }
+                        ranked.emplace_back(disp.squared_norm(), i);
+                    }
+                    std::sort(ranked.begin(), ranked.end());
+
+                    std::multiset<md::index> actual_neighbors;
+                    searcher.query(center, std::inserter(actual_neighbors, actual_neighbors.end()));
+                    CHECK(equal(actual_neighbors, expect_neighbors));
+
+                    std::vector<md::index> knn;
+                    searcher.knn(center, 10, std::back_inserter(knn));
+                    REQUIRE(knn.size() == 10);
+                    for (md::index rank = 0; rank < knn.size(); rank++) {
+                        CHECK(knn[rank] == ranked[rank].second);
+                    }
+                }
+
+                for (auto& point : points) {
+                    point += {step(random), step(random), 0.05 + 4 * step(random)};
+                }
+                searcher.update_points(points);
+            }
+        }
+    };
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_period = 1;
+
+        // Merging the sparse z layers of the gas leaves fewer empty buckets.
+        auto count_empty_buckets = [&](bool adaptive) {
+            md::neighbor_search_options options;
+            options.adaptive_bins = adaptive;
+
+            md::nsearch_detail::search_grid<md::periodic_box> grid{box, neighbor_distance, options};
+            grid.fit(points);
+
+            std::vector<md::index> occupancy(grid.bucket_count());
+            for (auto const& point : points) {
+                occupancy[grid.locate_bucket(point)]++;
+            }
+            return md::index(std::count(occupancy.begin(), occupancy.end(), 0));
+        };
+        CHECK(count_empty_buckets(true) * 2 < count_empty_buckets(false));
+
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_span = 1;
+        box.particle_count = point_count;
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_searcher - region queries find points in spheres, boxes and slabs")
+{
+    md::index const point_count = 1000;
+    md::scalar const neighbor_distance = 0.1;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+
+    auto test_on_box = [&](auto box, md::scalar span, md::neighbor_search_options options) {
+        // Points may lie outside the periodic box.
+        std::vector<md::point> points;
+        std::generate_n(std::back_inserter(points), point_count, [&] {
+            return md::point{
+                span * (3 * coord(random) - 1),
+                span * coord(random),
+                span * coord(random)
+            };
+        });
+
+        using box_type = decltype(box);
+        md::neighbor_searcher<box_type> searcher{box, neighbor_distance, options};
+        searcher.set_points(points);
+
+        auto check_region = [&](auto inside, auto query) {
+            std::set<md::index> expect;
+            for (md::index i = 0; i < points.size(); i++) {
+                if (inside(points[i])) {
+                    expect.insert(i);
+                }
+            }
+
+            std::multiset<md::index> actual;
+            query(std::inserter(actual, actual.end()));
+            CHECK(equal(actual, expect));
+        };
+
+        // Spheres of small to huge radii.
+        for (auto const radius : {0.0, 0.05, 0.3, 0.7, 100.0}) {
+            md::point const center = {0.95 * span, 0.5 * span, 0.02 * span};
+
+            check_region(
+                [&](md::point point) {
+                    return box.shortest_displacement(point, center).norm() <= radius;
+                },
+                [&](auto out) {
+                    searcher.query_sphere(center, radius, out);
+                }
+            );
+        }
+
+        // Boxes, including ones straddling the periodic boundary.
+        std::vector<std::pair<md::point, md::point>> const regions = {
+            {{0.2 * span, 0.3 * span, 0.1 * span}, {0.5 * span, 0.4 * span, 0.9 * span}},
+            {{-0.1 * span, 0.9 * span, 0.8 * span}, {0.1 * span, 1.2 * span, 1.05 * span}},
+            {{-5, -5, -5}, {5, 5, 5}},
+            {{0.5, 0.5, 0.5}, {0.4, 0.6, 0.6}},
+        };
+
+        for (auto const& region : regions) {
+            auto const lower = region.first;
+            auto const upper = region.second;
+
+            check_region(
+                [&](md::point point) {
+                    // A point is in the box if its image closest to the box
+                    // center is.
+                    auto const center = lower + (upper - lower) / 2;
+                    auto const disp = box.shortest_displacement(point, center);
+                    auto const image = center + disp;
+                    return lower.x <= image.x && image.x <= upper.x
+                        && lower.y <= image.y && image.y <= upper.y
+                        && lower.z <= image.z && image.z <= upper.z;
+                },
+                [&](auto out) {
+                    searcher.query_box(lower, upper, out);
+                }
+            );
+        }
+
+        // Slabs.
+        for (auto const& z_range : {std::make_pair(0.4, 0.45), std::make_pair(-0.05, 0.05)}) {
+            auto const z_lower = z_range.first * span;
+            auto const z_upper = z_range.second * span;
+
+            check_region(
+                [&](md::point point) {
+                    auto const z_center = (z_lower + z_upper) / 2;
+                    md::point const center = {point.x, point.y, z_center};
+                    auto const z = z_center + box.shortest_displacement(point, center).z;
+                    return z_lower <= z && z <= z_upper;
+                },
+                [&](auto out) {
+                    searcher.query_slab(z_lower, z_upper, out);
+                }
+            );
+        }
+    };
+
+    auto test_on_options = [&](md::neighbor_search_options options) {
+        SECTION("open_box")
+        {
+            md::open_box box;
+            box.particle_count = point_count;
+            test_on_box(box, 1, options);
+        }
+
+        SECTION("sparse open_box")
+        {
+            md::open_box box;
+            box.particle_count = point_count;
+            test_on_box(box, 10, options);
+        }
+
+        SECTION("periodic_box")
+        {
+            md::periodic_box box;
+            box.x_period = 1;
+            box.y_period = 1;
+            box.z_period = 1;
+            test_on_box(box, 1, options);
+        }
+
+        SECTION("xy_periodic_box")
+        {
+            md::xy_periodic_box box;
+            box.x_period = 1;
+            box.y_period = 1;
+            box.z_span = 1;
+            box.particle_count = point_count;
+            test_on_box(box, 1, options);
+        }
+    };
+
+    SECTION("default options")
+    {
+        test_on_options({});
+    }
+
+    SECTION("exact hash, compact members and adaptive bins")
+    {
+        md::neighbor_search_options options;
+        options.open_grid = md::open_grid_policy::exact_hash;
+        options.compact_members = true;
+        options.adaptive_bins = true;
+        test_on_options(options);
+    }
+}
+
+TEST_CASE("neighbor_searcher::search_bipartite - finds pairs between probes and points")
+{
+    md::scalar const neighbor_distance = 0.15;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    std::uniform_real_distribution<md::scalar> probe_coord{-0.5, 1.5};
+
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), 1500, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    std::vector<md::point> probes;
+    std::generate_n(std::back_inserter(probes), 700, [&] {
+        return md::point{probe_coord(random), probe_coord(random), probe_coord(random)};
+    });
+
+    auto test_on_box = [&](auto box) {
+        std::set<std::pair<md::index, md::index>> expect;
+
+        for (md::index k = 0; k < probes.size(); k++) {
+            for (md::index i = 0; i < points.size(); i++) {
+                md::vector const disp = box.shortest_displacement(probes[k], points[i]);
+                if (disp.squared_norm() <= neighbor_distance * neighbor_distance) {
+                    expect.emplace(k, i);
+                }
+            }
+        }
+
+        for (bool compact : {false, true}) {
+            md::neighbor_search_options options;
+            options.compact_members = compact;
+
+            using box_type = decltype(box);
+            md::neighbor_searcher<box_type> searcher{box, neighbor_distance, options};
+            searcher.set_points(points);
+
+            for (md::index thread_count : {md::index(1), md::index(3)}) {
+                std::multiset<std::pair<md::index, md::index>> actual;
+                searcher.search_bipartite(probes, std::inserter(actual, actual.end()), thread_count);
+                CHECK(equal(actual, expect));
+            }
+        }
+    };
+
+    SECTION("open_box")
+    {
+        md::open_box box;
+        box.particle_count = points.size();
+        test_on_box(box);
+    }
+
+    SECTION("periodic_box")
+    {
+        md::periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_period = 1;
+        test_on_box(box);
+    }
+
+    SECTION("xy_periodic_box")
+    {
+        md::xy_periodic_box box;
+        box.x_period = 1;
+        box.y_period = 1;
+        box.z_span = 1;
+        box.particle_count = points.size();
+        test_on_box(box);
+    }
+}
+
+TEST_CASE("neighbor_searcher::reshape - adapts grid to changed z span")
+{
+    // Dense enough that the number of z bins follows z_span.
+    md::index const point_count = 2000;
+    md::scalar const neighbor_distance = 0.2;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+
+    md::xy_periodic_box box;
+    box.x_period = 1;
+    box.y_period = 1;
+    box.z_span = 1;
+    box.particle_count = point_count;
+
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::neighbor_searcher<md::xy_periodic_box> searcher{box, neighbor_distance};
+    searcher.set_points(points);
+
+    // The film swells and then shrinks along z.
+    for (md::scalar const z_scale : {1.5, 2.0, 0.5}) {
+        for (auto& point : points) {
+            point.z *= z_scale;
+        }
+        box.z_span *= z_scale;
+
+        REQUIRE(searcher.reshape(box));
+        searcher.update_points(points);
+
+        std::set<std::pair<md::index, md::index>> expect;
+        for (md::index j = 0; j < points.size(); j++) {
+            for (md::index i = 0; i < j; i++) {
+                md::vector const disp = box.shortest_displacement(points[i], points[j]);
+                if (disp.norm() <= neighbor_distance) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+
+        std::multiset<std::pair<md::index, md::index>> actual;
+        searcher.search(std::inserter(actual, actual.end()));
+        CHECK(equal(actual, expect));
+    }
+
+    // Changing the x/y layout needs a new searcher.
+    auto new_box = box;
+    new_box.x_period = 2;
+    CHECK_FALSE(searcher.reshape(new_box));
+}
+
+TEST_CASE("neighbor_searcher::reshape - keeps open_box grid as particle count changes")
+{
+    md::scalar const neighbor_distance = 0.1;
+
+    // Compact cloud is binned and sparse cloud is hashed.
+    auto test_on_span = [&](md::scalar span) {
+        std::mt19937 random;
+        std::uniform_real_distribution<md::scalar> coord{0, span};
+
+        std::vector<md::point> points;
+        std::generate_n(std::back_inserter(points), 500, [&] {
+            return md::point{coord(random), coord(random), coord(random)};
+        });
+
+        md::open_box box;
+        box.particle_count = points.size();
+
+        md::neighbor_searcher<md::open_box> searcher{box, neighbor_distance};
+        searcher.set_points(points);
+
+        // Insert particles one by one, then in bulk beyond the capacity, and
+        // finally remove most of them.
+        std::vector<md::index> const counts = {501, 502, 503, 520, 2000, 1990, 300};
+
+        for (auto const count : counts) {
+            while (points.size() < count) {
+                points.push_back({coord(random), coord(random), coord(random)});
+            }
+            points.resize(count);
+            box.particle_count = count;
+
+            REQUIRE(searcher.reshape(box));
+            searcher.update_points(points);
+
+            std::set<std::pair<md::index, md::index>> expect;
+            for (md::index j = 0; j < points.size(); j++) {
+                for (md::index i = 0; i < j; i++) {
+                    if (md::distance(points[i], points[j]) <= neighbor_distance) {
+                        expect.emplace(i, j);
+                    }
+                }
+            }
+
+            std::multiset<std::pair<md::index, md::index>> actual;
+            searcher.search(std::inserter(actual, actual.end()));
+            CHECK(equal(actual, expect));
+        }
+    };
+
+    test_on_span(1);
+    test_on_span(3);
+}
+
+TEST_CASE("neighbor_searcher::reshape - keeps merged z bins of periodic box")
+{
+    md::index const point_count = 1000;
+    md::scalar const neighbor_distance = 0.125;
+
+    // Points gather in a slab, so that the empty z bins get merged.
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 1};
+    std::uniform_real_distribution<md::scalar> z_coord{0, 0.3};
+
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), point_count, [&] {
+        return md::point{coord(random), coord(random), z_coord(random)};
+    });
+
+    md::periodic_box box;
+    box.x_period = 1;
+    box.y_period = 1;
+    box.z_period = 1;
+
+    md::neighbor_search_options options;
+    options.adaptive_bins = true;
+
+    // The z period grows by two bins.
+    auto new_box = box;
+    new_box.z_period = 1.25;
+
+    SECTION("grid")
+    {
+        md::nsearch_detail::search_grid<md::periodic_box> grid{box, neighbor_distance, options};
+        grid.fit(points);
+
+        auto const bucket_count = grid.bucket_count();
+        std::vector<size_t> buckets;
+        for (auto const& point : points) {
+            buckets.push_back(grid.locate_bucket(point));
+        }
+        REQUIRE(bucket_count < 8 * 8 * 8);
+
+        REQUIRE(grid.reshape(new_box));
+        CHECK(grid.bucket_count() > bucket_count);
+        CHECK(grid.bucket_count() < 8 * 8 * 10);
+
+        for (md::index i = 0; i < points.size(); i++) {
+            CHECK(grid.locate_bucket(points[i]) == buckets[i]);
+        }
+    }
+
+    SECTION("searcher")
+    {
+        md::neighbor_searcher<md::periodic_box> searcher{box, neighbor_distance, options};
+        searcher.set_points(points);
+
+        REQUIRE(searcher.reshape(new_box));
+        searcher.update_points(points);
+
+        std::set<std::pair<md::index, md::index>> expect;
+        for (md::index j = 0; j < points.size(); j++) {
+            for (md::index i = 0; i < j; i++) {
+                md::vector const disp = new_box.shortest_displacement(points[i], points[j]);
+                if (disp.norm() <= neighbor_distance) {
+                    expect.emplace(i, j);
+                }
+            }
+        }
+
+        std::multiset<std::pair<md::index, md::index>> actual;
+        searcher.search(std::inserter(actual, actual.end()));
+        CHECK(equal(actual, expect));
+    }
+}
+
+TEST_CASE("neighbor_searcher::reshape - keeps open_box hash as particles are added one by one")
+{
+    md::scalar const neighbor_distance = 0.1;
+
+    // Sparse enough to be hashed.
+    std::mt19937 random;
+    std::uniform_real_distribution<md::scalar> coord{0, 3};
+
+    std::vector<md::point> points;
+    std::generate_n(std::back_inserter(points), 500, [&] {
+        return md::point{coord(random), coord(random), coord(random)};
+    });
+
+    md::open_box box;
+    box.particle_count = points.size();
+
+    md::nsearch_detail::search_grid<md::open_box> grid{box, neighbor_distance};
+    grid.fit(points);
+
+    // Growing beyond the initial capacity reserves room for more points.
+    points.push_back({coord(random), coord(random), coord(random)});
+    box.particle_count = points.size();
+    REQUIRE(grid.reshape(box));
+    grid.fit(points);
+
+    auto const modulus = grid.hash.modulus;
+    auto const bucket_count = grid.bucket_count();
+
+    for (md::index const count : {502u, 503u}) {
+        points.push_back({coord(random), coord(random), coord(random)});
+        box.particle_count = count;
+
+        REQUIRE(grid.reshape(box));
+        CHECK(grid.hash.modulus == modulus);
+        CHECK_FALSE(grid.fit(points));
+        CHECK(grid.bucket_count() == bucket_count);
+    }
+}